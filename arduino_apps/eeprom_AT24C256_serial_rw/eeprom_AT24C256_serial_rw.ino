@@ -23,6 +23,19 @@
 #include <Wire.h>
 
 #define SERIAL_BUFFER 50
+#define WRITE_TIMEOUT 500
+//the internal write cycle of the eeprom takes at most 5 ms
+#define WRITE_CYCLE_TIMEOUT 20
+//bytes read at once from the eeprom for hash, the Wire buffer size
+#define HASH_CHUNK 32
+//data bytes in one Wire transaction, one byte of it is the address
+#ifdef BUFFER_LENGTH
+#define WIRE_PAYLOAD (BUFFER_LENGTH - 1)
+#else
+#define WIRE_PAYLOAD 31
+#endif
+//ram kept free for stack and Serial/Wire when the buffer grows
+#define RAM_RESERVE 256
 boolean cleanupSerial;
 bool isValidInput;
 char inData[SERIAL_BUFFER]; // Allocate some space for the string
@@ -78,7 +91,7 @@ void readBytes_EEPROM(int deviceAddress, unsigned int address, byte * buffer, in
   Wire.endTransmission();
 }
 
-void writeBytes_EEPROM(int deviceAddress, unsigned int address, byte *data, int length)
+byte writeBytes_EEPROM(int deviceAddress, unsigned int address, byte *data, int length)
 {
   Wire.beginTransmission(deviceAddress);
 //  Wire.write((int) (address >> 8)); //MSB
@@ -87,10 +100,38 @@ void writeBytes_EEPROM(int deviceAddress, unsigned int address, byte *data, int
   for(int idx = 0; idx < length; idx++) {
     Wire.write(data[idx]);
   }
-  Wire.endTransmission();
+  return Wire.endTransmission();
+}
+
+//the eeprom does not acknowledge its address until the write cycle is over
+boolean waitWriteCycle(int deviceAddress)
+{
+  unsigned long start = millis();
+  do {
+    Wire.beginTransmission(deviceAddress);
+    if ( Wire.endTransmission() == 0 ) {
+      return true;
+    }
+  } while ( millis() - start < WRITE_CYCLE_TIMEOUT );
+  return false;
 }
 
 
+unsigned long crc32_update(unsigned long crc, byte *data, int length)
+{
+  for ( int idx = 0; idx < length; idx++ ) {
+    crc ^= data[idx];
+    for ( uint8_t bit = 0; bit < 8; bit++ ) {
+      if ( crc & 1 ) {
+        crc = (crc >> 1) ^ 0xEDB88320;
+      } else {
+        crc = crc >> 1;
+      }
+    }
+  }
+  return crc;
+}
+
 boolean isValidNumber( char *data, int size )
 {
   if ( size == 0 ) return false;
@@ -103,6 +144,33 @@ boolean isValidNumber( char *data, int size )
    return true;
 }
 
+//free ram between heap and stack, only known on AVR boards
+int freeRam() {
+#ifdef __AVR__
+  extern int __heap_start, *__brkval;
+  int v;
+  return (int) &v - (__brkval == 0 ? (int) &__heap_start : (int) __brkval);
+#else
+  //0 keeps the current buffer, the payload is bounded by Wire anyway
+  return 0;
+#endif
+}
+
+//largest buffer which could be allocated instead of the current one
+unsigned int maxBuffer() {
+  int available = freeRam() - RAM_RESERVE;
+  if ( available < 0 ) {
+    return readWriteBufferLen;
+  }
+  return readWriteBufferLen + available;
+}
+
+//largest chunk which is read or written in one Wire transaction
+unsigned int maxPayload() {
+  unsigned int buffer = maxBuffer();
+  return buffer < WIRE_PAYLOAD ? buffer : WIRE_PAYLOAD;
+}
+
 boolean makeCleanup() {
   for ( index = 0; index < SERIAL_BUFFER; index++ ) {
     inData[index] = '\0';
@@ -126,7 +194,16 @@ void processCommand() {
   if ( index > 0 ) {
      inData[index-1] = '\0';
   }
-  if ( strlen(inData) > 1 ) {
+  //report free ram and max payload, the page size depends on the chip
+  if ( strlen(inData) == 1 && inData[0] == 'i' ) {
+    Serial.print('I');
+    Serial.print(freeRam());
+    Serial.print(',');
+    Serial.print(maxPayload());
+    Serial.print('#');
+    Serial.flush();
+  }
+  else if ( strlen(inData) > 1 ) {
     //read one byte
     if ( inData[0] == 'r' ) {
       //remove r
@@ -244,6 +321,13 @@ void processCommand() {
         buf[idx] = inData[i];
       }
       int length = atoi(buf);
+      //more than one Wire transaction would come back zero padded
+      if ( length <= 0 || length > WIRE_PAYLOAD ) {
+        Serial.print("E#");
+        Serial.flush();
+        makeCleanup();
+        return;
+      }
       if ( length > readWriteBufferLen ) {
         delete [] receiveSendBuffer;
         readWriteBufferLen = length;
@@ -253,6 +337,63 @@ void processCommand() {
       readBytes_EEPROM(deviceAddress, address, receiveSendBuffer, length);
       
       Serial.write(receiveSendBuffer,sizeof(byte) * length);
+      //crc32 of the data so the host could check the chunk
+      Serial.print(~crc32_update(0xFFFFFFFF, receiveSendBuffer, length), HEX);
+      Serial.print('#');
+      Serial.flush();
+    }
+    // hash (crc32) of multiple bytes
+    else if ( inData[0] == 'H' ) {
+      //remove H
+      for ( uint8_t i = 0 ; i < strlen(inData); i++ ) {
+        inData[i]=inData[i+1];
+      }
+      inData[strlen(inData)] = '\0';
+      uint8_t position;
+      for ( uint8_t i = 0; i < strlen(inData); i++ ) {
+        if ( inData[i] == ',' ) {
+          position = i;
+          break;
+        }
+      }
+      char buf[10];
+      memset(buf,'\0', 10 * sizeof(char));
+      
+      for ( int i = 0 ; i < position; i++ ) {
+        buf[i] = inData[i];
+      }      
+      int deviceAddress = strtol(buf, 0, 16);
+
+      memset(buf,'\0', 10 * sizeof(char));
+      
+      uint8_t oldPosition = position;
+      for ( uint8_t i = oldPosition + 1; i < strlen(inData); i++ ) {
+        if ( inData[i] == ',' ) {
+          position = i;
+          break;
+        }
+      }
+      for ( int i = oldPosition + 1, idx = 0; i < position; i++, idx++ ) {
+        buf[idx] = inData[i];
+      }
+      unsigned int address = atoi(buf);
+
+      memset(buf,'\0', 10 * sizeof(char));
+
+      for ( int i = position + 1, idx = 0; i < strlen(inData); i++, idx++ ) {
+        buf[idx] = inData[i];
+      }
+      long length = atol(buf);
+      unsigned long crc = 0xFFFFFFFF;
+      while ( length > 0 ) {
+        int chunk = length > HASH_CHUNK ? HASH_CHUNK : length;
+        readBytes_EEPROM(deviceAddress, address, receiveSendBuffer, chunk);
+        crc = crc32_update(crc, receiveSendBuffer, chunk);
+        address += chunk;
+        length -= chunk;
+      }
+      Serial.print(~crc, HEX);
+      Serial.print('#');
       Serial.flush();
     }
     // write multiple bytes
@@ -301,7 +442,9 @@ void processCommand() {
         idx++;
       }
       int length = atoi(buf);
-      if ( length > readWriteBufferLen ) {
+      //more than one Wire transaction would be cut, the data is still drained
+      boolean accepted = length > 0 && length <= WIRE_PAYLOAD;
+      if ( accepted && length > readWriteBufferLen ) {
         delete [] receiveSendBuffer;
         readWriteBufferLen = length;
         receiveSendBuffer = new byte[readWriteBufferLen];
@@ -309,15 +452,33 @@ void processCommand() {
       memset(receiveSendBuffer, '\0', sizeof(byte) * readWriteBufferLen);
       int index = 0;
       char inByte;
+      unsigned long lastReceived = millis();
       while ( index < length ) {
-        while ( Serial.available() > 0 ) // Don't read unless there you know there is data
+        while ( Serial.available() > 0 && index < length ) // Don't read unless there you know there is data
         {
           inByte = Serial.read(); // Read a character
-          receiveSendBuffer[index] = inByte;
+          if ( accepted ) {
+            receiveSendBuffer[index] = inByte;
+          }
           ++index;
+          lastReceived = millis();
+        }
+        //the host will send the chunk again if it is not acknowledged
+        if ( millis() - lastReceived > WRITE_TIMEOUT ) {
+          break;
+        }
+      }
+      if ( index == length ) {
+        //acknowledge the chunk only when the eeprom took it, K and E are never
+        //part of the hex hash answer; the host sends the chunk again on E
+        if ( accepted && writeBytes_EEPROM(deviceAddress, address, receiveSendBuffer, length) == 0
+             && waitWriteCycle(deviceAddress) ) {
+          Serial.print("K#");
+        } else {
+          Serial.print("E#");
         }
+        Serial.flush();
       }
-      writeBytes_EEPROM(deviceAddress, address, receiveSendBuffer, length);
     }
     //set buffer length
     else if ( inData[0] == 'b' ) {
@@ -331,7 +492,7 @@ void processCommand() {
         return;
       }
       unsigned int val = atoi(inData);
-      if ( val > readWriteBufferLen ) {
+      if ( val > readWriteBufferLen && val <= maxBuffer() ) {
         delete [] receiveSendBuffer;
         readWriteBufferLen = val;
         receiveSendBuffer = new byte[readWriteBufferLen];
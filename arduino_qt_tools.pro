@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Arduino tools, build the shared library first
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+        common \
+        serial_monitor \
+        read_write_eeprom \
+        serial_replay
+
+serial_monitor.depends = common
+read_write_eeprom.depends = common
+serial_replay.depends = common
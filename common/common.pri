@@ -0,0 +1,21 @@
+# Link with the library shared by the arduino tools, built by the top
+# level arduino_qt_tools.pro ; when a tool is built on its own and the
+# library is not there the sources are compiled in the tool.
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SERIAL_COMMON_BUILD = $$OUT_PWD/../common
+SERIAL_COMMON_DIR = $$SERIAL_COMMON_BUILD
+win32:CONFIG(release, debug|release): SERIAL_COMMON_DIR = $$SERIAL_COMMON_DIR/release
+else:win32:CONFIG(debug, debug|release): SERIAL_COMMON_DIR = $$SERIAL_COMMON_DIR/debug
+
+win32:!win32-g++: SERIAL_COMMON_LIB = $$SERIAL_COMMON_DIR/serial_common.lib
+else: SERIAL_COMMON_LIB = $$SERIAL_COMMON_DIR/libserial_common.a
+
+exists($$SERIAL_COMMON_BUILD/Makefile)|exists($$SERIAL_COMMON_LIB) {
+    LIBS += -L$$SERIAL_COMMON_DIR/ -lserial_common
+    PRE_TARGETDEPS += $$SERIAL_COMMON_LIB
+} else {
+    include(sources.pri)
+}
@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# Library shared by the arduino tools
+#
+#-------------------------------------------------
+
+QT       += core serialport
+QT       -= gui
+
+TARGET = serial_common
+TEMPLATE = lib
+CONFIG += staticlib c++14
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(sources.pri)
@@ -0,0 +1,194 @@
+/*
+ * Serial port discovery for arduino tools
+ *
+ * Copyright 2024 Gabriel Dimitriu
+ *
+ * This file is part of arduino_qt_tools project.
+
+ * arduino_qt_tools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * arduino_qt_tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with arduino_qt_tools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+
+#include "portwatcher.h"
+#include <QMetaType>
+
+//udev needs some time to finish the device node after it is created
+#define SCAN_DEBOUNCE 300
+#define SCAN_POLL 1000
+
+PortScanner::PortScanner(QObject *parent) :
+    QObject(parent)
+{
+    debounceTimer = nullptr;
+    pollTimer = nullptr;
+    watcher = nullptr;
+}
+
+/*
+ * Called on the scanner thread so the timers and the watcher live there.
+ */
+void PortScanner::start()
+{
+    debounceTimer = new QTimer(this);
+    debounceTimer->setSingleShot(true);
+    connect(debounceTimer, SIGNAL(timeout()), this, SLOT(scan()));
+#ifdef Q_OS_LINUX
+    watcher = new QFileSystemWatcher(this);
+    watcher->addPath("/dev");
+    connect(watcher, SIGNAL(directoryChanged(QString)), this, SLOT(scheduleScan()));
+#else
+    pollTimer = new QTimer(this);
+    connect(pollTimer, SIGNAL(timeout()), this, SLOT(scan()));
+    pollTimer->start(SCAN_POLL);
+#endif
+    scan();
+}
+
+void PortScanner::scheduleScan()
+{
+    if ( debounceTimer != nullptr )
+        debounceTimer->start(SCAN_DEBOUNCE);
+}
+
+void PortScanner::scan()
+{
+    emit scanned(QSerialPortInfo::availablePorts());
+}
+
+PortWatcher::PortWatcher(QObject *parent) :
+    QObject(parent)
+{
+    qRegisterMetaType<QSerialPortInfo>("QSerialPortInfo");
+    qRegisterMetaType<QList<QSerialPortInfo> >("QList<QSerialPortInfo>");
+    thread = new QThread(this);
+    scanner = new PortScanner();
+    scanner->moveToThread(thread);
+    connect(thread, SIGNAL(started()), scanner, SLOT(start()));
+    connect(thread, SIGNAL(finished()), scanner, SLOT(deleteLater()));
+    connect(scanner, SIGNAL(scanned(QList<QSerialPortInfo>)), this, SLOT(portsScanned(QList<QSerialPortInfo>)));
+}
+
+PortWatcher::~PortWatcher()
+{
+    thread->quit();
+    thread->wait();
+}
+
+void PortWatcher::start()
+{
+    if ( !thread->isRunning() )
+        thread->start();
+}
+
+void PortWatcher::rescan()
+{
+    QMetaObject::invokeMethod(scanner, "scan", Qt::QueuedConnection);
+}
+
+/*
+ * Filter is a comma separated list of VID:PID or VID in hex,
+ * for example 2341:0043,1a86 ; an empty filter keeps all the ports.
+ */
+void PortWatcher::setFilter(QString filter)
+{
+    filters.clear();
+    foreach (const QString &entry, filter.split(','))
+    {
+        if ( entry.trimmed().isEmpty() )
+            continue;
+        QStringList ids = entry.trimmed().split(':');
+        bool ok;
+        quint16 vendor = ids[0].toUShort(&ok, 16);
+        if ( !ok )
+            continue;
+        quint16 product = 0;
+        if ( ids.size() > 1 )
+            product = ids[1].toUShort(&ok, 16);
+        filters.append(qMakePair(vendor, product));
+    }
+}
+
+QList<QSerialPortInfo> PortWatcher::ports() const
+{
+    return cachedPorts;
+}
+
+QString PortWatcher::describe(const QSerialPortInfo &info)
+{
+    QString description = info.portName() + " " + info.description();
+    if ( info.hasVendorIdentifier() && info.hasProductIdentifier() )
+    {
+        description += QString(" [%1:%2]").arg(info.vendorIdentifier(), 4, 16, QChar('0'))
+                .arg(info.productIdentifier(), 4, 16, QChar('0'));
+    }
+    return description;
+}
+
+bool PortWatcher::matchesFilter(const QSerialPortInfo &info) const
+{
+    if ( filters.isEmpty() )
+        return true;
+    if ( !info.hasVendorIdentifier() )
+        return false;
+    for ( int i = 0; i < filters.size(); i++ )
+    {
+        if ( filters[i].first != info.vendorIdentifier() )
+            continue;
+        if ( filters[i].second == 0 || ( info.hasProductIdentifier() && filters[i].second == info.productIdentifier() ) )
+            return true;
+    }
+    return false;
+}
+
+void PortWatcher::portsScanned(QList<QSerialPortInfo> ports)
+{
+    QList<QSerialPortInfo> filtered;
+    foreach (const QSerialPortInfo &info, ports)
+    {
+        if ( matchesFilter(info) )
+            filtered.append(info);
+    }
+    QList<QSerialPortInfo> arrived;
+    QStringList removed;
+    foreach (const QSerialPortInfo &info, filtered)
+    {
+        bool known = false;
+        foreach (const QSerialPortInfo &cached, cachedPorts)
+        {
+            if ( cached.portName() == info.portName() )
+                known = true;
+        }
+        if ( !known )
+            arrived.append(info);
+    }
+    foreach (const QSerialPortInfo &cached, cachedPorts)
+    {
+        bool present = false;
+        foreach (const QSerialPortInfo &info, filtered)
+        {
+            if ( cached.portName() == info.portName() )
+                present = true;
+        }
+        if ( !present )
+            removed.append(cached.portName());
+    }
+    cachedPorts = filtered;
+    if ( arrived.isEmpty() && removed.isEmpty() )
+        return;
+    emit portsChanged();
+    foreach (const QString &portName, removed)
+        emit portRemoved(portName);
+    foreach (const QSerialPortInfo &info, arrived)
+        emit portArrived(info);
+}
@@ -0,0 +1,90 @@
+/*
+ * Serial port discovery for arduino tools
+ *
+ * Copyright 2024 Gabriel Dimitriu
+ *
+ * This file is part of arduino_qt_tools project.
+
+ * arduino_qt_tools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * arduino_qt_tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with arduino_qt_tools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+
+#ifndef PORTWATCHER_H
+#define PORTWATCHER_H
+
+#include <QObject>
+#include <QList>
+#include <QPair>
+#include <QThread>
+#include <QTimer>
+#include <QFileSystemWatcher>
+#include <QtSerialPort/QSerialPortInfo>
+
+Q_DECLARE_METATYPE(QSerialPortInfo)
+
+/*
+ * Enumerates the serial ports on its own thread, on Linux when /dev
+ * changes and elsewhere on a poll timer.
+ */
+class PortScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PortScanner(QObject *parent = 0);
+public slots:
+    void start();
+    void scan();
+    void scheduleScan();
+signals:
+    void scanned(QList<QSerialPortInfo> ports);
+private:
+    QTimer *debounceTimer;
+    QTimer *pollTimer;
+    QFileSystemWatcher *watcher;
+};
+
+/*
+ * Cached list of the serial ports, filtered by VID:PID, which reports
+ * the boards that are plugged and unplugged.
+ */
+class PortWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PortWatcher(QObject *parent = 0);
+    ~PortWatcher();
+    void setFilter(QString filter);
+    QList<QSerialPortInfo> ports() const;
+    static QString describe(const QSerialPortInfo &info);
+public slots:
+    void start();
+    void rescan();
+signals:
+    void portsChanged();
+    void portArrived(QSerialPortInfo info);
+    void portRemoved(QString portName);
+private slots:
+    void portsScanned(QList<QSerialPortInfo> ports);
+private:
+    QThread *thread;
+    PortScanner *scanner;
+    QList<QSerialPortInfo> cachedPorts;
+    //vendor and product id, product 0 matches any product
+    QList<QPair<quint16, quint16> > filters;
+    bool matchesFilter(const QSerialPortInfo &info) const;
+};
+
+#endif // PORTWATCHER_H
@@ -0,0 +1,348 @@
+/*
+ * Serial session for arduino tools
+ *
+ * Copyright 2024 Gabriel Dimitriu
+ *
+ * This file is part of arduino_qt_tools project.
+
+ * arduino_qt_tools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * arduino_qt_tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with arduino_qt_tools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+
+#include "serialsession.h"
+#include <QtSerialPort/QSerialPortInfo>
+
+SerialSession::SerialSession(QObject *parent) :
+    QObject(parent)
+{
+    serial = nullptr;
+    recorder = nullptr;
+    lineTermination = NONE;
+    receiveInterval = 0;
+    sentCount = 0;
+    receivedCount = 0;
+    receiveTimer = new QTimer(this);
+    receiveTimer->setSingleShot(true);
+    connect(receiveTimer, SIGNAL(timeout()), this, SLOT(deliverData()));
+    autoReconnect = false;
+    reconnectPending = false;
+    lastBaudRate = 0;
+    lastFlowControl = QSerialPort::NoFlowControl;
+    //retry while the board is away, a quick replug could be missed by the watcher
+    reconnectTimer = new QTimer(this);
+    reconnectTimer->setInterval(1000);
+    connect(reconnectTimer, SIGNAL(timeout()), this, SLOT(tryReconnect()));
+    watcher = new PortWatcher(this);
+    connect(watcher, SIGNAL(portsChanged()), this, SLOT(tryReconnect()));
+    watcher->start();
+}
+
+SerialSession::~SerialSession()
+{
+    close();
+}
+
+bool SerialSession::open(QString portName, qint32 baudRate, QSerialPort::FlowControl flowControl)
+{
+    closePort();
+    if ( portName.isEmpty() )
+        return false;
+    serial = new QSerialPort(this);
+    serial->setPortName(portName);
+    serial->setBaudRate(baudRate);
+    serial->setDataBits(QSerialPort::Data8);
+    serial->setParity(QSerialPort::NoParity);
+    serial->setStopBits(QSerialPort::OneStop);
+    serial->setFlowControl(flowControl);
+    connect(serial, SIGNAL(error(QSerialPort::SerialPortError)), this,
+            SLOT(handleError(QSerialPort::SerialPortError)));
+    connect(serial, SIGNAL(readyRead()), this, SLOT(readData()));
+    connect(serial, SIGNAL(bytesWritten(qint64)), this, SLOT(dataWritten(qint64)));
+    if ( !serial->open(QIODevice::ReadWrite) )
+        return false;
+    serial->setDataTerminalReady(true);
+    sentCount = 0;
+    receivedCount = 0;
+    sessionTimer.start();
+    reconnectPending = false;
+    reconnectTimer->stop();
+    lastPortName = portName;
+    lastSerialNumber = serialNumber();
+    lastBaudRate = baudRate;
+    lastFlowControl = flowControl;
+    return true;
+}
+
+//closed by the user, the board is not reopened
+void SerialSession::close()
+{
+    reconnectPending = false;
+    reconnectTimer->stop();
+    closePort();
+}
+
+void SerialSession::closePort()
+{
+    receiveTimer->stop();
+    receiveBuffer.clear();
+    if ( serial == nullptr )
+        return;
+    disconnect(serial, 0, this, 0);
+    serial->close();
+    //could be called from a slot connected to the port
+    serial->deleteLater();
+    serial = nullptr;
+}
+
+bool SerialSession::isOpen() const
+{
+    return serial != nullptr && serial->isOpen();
+}
+
+QString SerialSession::portName() const
+{
+    return serial == nullptr ? QString() : serial->portName();
+}
+
+QString SerialSession::serialNumber() const
+{
+    return serial == nullptr ? QString() : QSerialPortInfo(*serial).serialNumber();
+}
+
+QString SerialSession::errorString() const
+{
+    return serial == nullptr ? QString() : serial->errorString();
+}
+
+qint32 SerialSession::baudRate() const
+{
+    return serial == nullptr ? 0 : serial->baudRate();
+}
+
+void SerialSession::setBaudRate(qint32 baudRate)
+{
+    lastBaudRate = baudRate;
+    if ( isOpen() )
+        serial->setBaudRate(baudRate);
+}
+
+void SerialSession::setFlowControl(QSerialPort::FlowControl flowControl)
+{
+    lastFlowControl = flowControl;
+    if ( isOpen() )
+        serial->setFlowControl(flowControl);
+}
+
+void SerialSession::setLineTermination(int termination)
+{
+    lineTermination = termination;
+}
+
+/*
+ * With an interval the bytes received in that time are delivered
+ * together, which saves the repaints of the views on fast links.
+ */
+void SerialSession::setReceiveInterval(int interval)
+{
+    receiveInterval = interval;
+}
+
+/*
+ * The recorder gets every chunk written and every chunk received as it
+ * comes from the port, before the receive batching.
+ */
+void SerialSession::setRecorder(SessionRecorder *recorder)
+{
+    this->recorder = recorder;
+}
+
+QByteArray SerialSession::frame(QByteArray data) const
+{
+    switch ( lineTermination )
+    {
+    case LINE_TERMINATION::LF :
+        data.append('\n');
+        break;
+    case LINE_TERMINATION::CR :
+        data.append('\r');
+        break;
+    case LINE_TERMINATION::CR_LF :
+        data.append("\r\n");
+        break;
+    default:
+        break;
+    }
+    return data;
+}
+
+qint64 SerialSession::write(const QByteArray &data)
+{
+    return write(data.constData(), data.size());
+}
+
+qint64 SerialSession::write(const char *data, qint64 length)
+{
+    if ( !isOpen() )
+        return -1;
+    qint64 written = serial->write(data, length);
+    if ( recorder != nullptr && written > 0 )
+        recorder->record(SessionRecorder::SENT, QByteArray(data, written));
+    return written;
+}
+
+qint64 SerialSession::sendLine(QString line)
+{
+    return write(frame(line.toLatin1()));
+}
+
+void SerialSession::clearInput()
+{
+    receiveTimer->stop();
+    receiveBuffer.clear();
+    if ( isOpen() )
+        serial->clear(QSerialPort::Input);
+}
+
+void SerialSession::clearOutput()
+{
+    if ( isOpen() )
+        serial->clear(QSerialPort::Output);
+}
+
+quint64 SerialSession::bytesSent() const
+{
+    return sentCount;
+}
+
+quint64 SerialSession::bytesReceived() const
+{
+    return receivedCount;
+}
+
+QString SerialSession::metrics() const
+{
+    double seconds = qMax<qint64>(sessionTimer.isValid() ? sessionTimer.elapsed() : 0, 1) / 1000.0;
+    return tr("Sent %1 bytes (%2 B/s), received %3 bytes (%4 B/s) in %5 s")
+            .arg(sentCount).arg(sentCount / seconds, 0, 'f', 0)
+            .arg(receivedCount).arg(receivedCount / seconds, 0, 'f', 0)
+            .arg(seconds, 0, 'f', 1);
+}
+
+PortWatcher *SerialSession::portWatcher() const
+{
+    return watcher;
+}
+
+bool SerialSession::isReconnecting() const
+{
+    return reconnectPending;
+}
+
+/*
+ * When the port is lost the board is reopened with the same settings as
+ * soon as it is plugged again, on any port name if it has a serial number.
+ */
+void SerialSession::setAutoReconnect(bool enabled)
+{
+    autoReconnect = enabled;
+    if ( !enabled )
+    {
+        reconnectPending = false;
+        reconnectTimer->stop();
+    }
+}
+
+void SerialSession::setPortFilter(QString filter)
+{
+    watcher->setFilter(filter);
+    watcher->rescan();
+}
+
+void SerialSession::handleError(QSerialPort::SerialPortError error)
+{
+    if ( error == QSerialPort::ResourceError )
+    {
+        QString message = serial->errorString();
+        if ( autoReconnect && !lastPortName.isEmpty() )
+        {
+            //the board was unplugged or reset, wait for it to come back
+            closePort();
+            reconnectPending = true;
+            reconnectTimer->start();
+        }
+        emit connectionLost(message);
+        //the port could still be there if it was only reset
+        tryReconnect();
+    }
+}
+
+/*
+ * Called on every change of the port list and by the retry timer until
+ * the board is open again.
+ */
+void SerialSession::tryReconnect()
+{
+    if ( !reconnectPending )
+        return;
+    //the board could come back on another port name, the serial number identifies it
+    QString portName;
+    foreach (const QSerialPortInfo &info, watcher->ports())
+    {
+        if ( lastSerialNumber.isEmpty() ? info.portName() == lastPortName : info.serialNumber() == lastSerialNumber )
+        {
+            portName = info.portName();
+            break;
+        }
+    }
+    //ports without a serial number, like a pseudo terminal, could be missing from the list
+    if ( portName.isEmpty() && lastSerialNumber.isEmpty() )
+        portName = lastPortName;
+    if ( portName.isEmpty() )
+        return;
+    if ( open(portName, lastBaudRate, lastFlowControl) )
+        emit reconnected(portName);
+    else
+        closePort();
+}
+
+void SerialSession::readData()
+{
+    QByteArray data = serial->readAll();
+    receivedCount += data.size();
+    if ( recorder != nullptr )
+        recorder->record(SessionRecorder::RECEIVED, data);
+    if ( receiveInterval <= 0 )
+    {
+        emit dataReceived(data);
+        return;
+    }
+    receiveBuffer.append(data);
+    if ( !receiveTimer->isActive() )
+        receiveTimer->start(receiveInterval);
+}
+
+void SerialSession::deliverData()
+{
+    if ( receiveBuffer.isEmpty() )
+        return;
+    QByteArray data = receiveBuffer;
+    receiveBuffer.clear();
+    emit dataReceived(data);
+}
+
+void SerialSession::dataWritten(qint64 bytes)
+{
+    sentCount += bytes;
+    emit bytesWritten(bytes);
+}
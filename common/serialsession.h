@@ -0,0 +1,107 @@
+/*
+ * Serial session for arduino tools
+ *
+ * Copyright 2024 Gabriel Dimitriu
+ *
+ * This file is part of arduino_qt_tools project.
+
+ * arduino_qt_tools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * arduino_qt_tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with arduino_qt_tools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+
+#ifndef SERIALSESSION_H
+#define SERIALSESSION_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QSerialPort>
+#include "portwatcher.h"
+#include "sessionrecording.h"
+
+/*
+ * Serial connection shared by the arduino tools: opens the port with the
+ * 8N1 settings of the sketches, frames the lines, batches the received
+ * bytes, counts the traffic and reopens the board when it comes back.
+ */
+class SerialSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum LINE_TERMINATION { NONE, LF, CR, CR_LF};
+    explicit SerialSession(QObject *parent = 0);
+    ~SerialSession();
+    bool open(QString portName, qint32 baudRate, QSerialPort::FlowControl flowControl = QSerialPort::NoFlowControl);
+    void close();
+    bool isOpen() const;
+    QString portName() const;
+    QString serialNumber() const;
+    QString errorString() const;
+    qint32 baudRate() const;
+    void setBaudRate(qint32 baudRate);
+    void setFlowControl(QSerialPort::FlowControl flowControl);
+    void setLineTermination(int termination);
+    void setReceiveInterval(int interval);
+    void setRecorder(SessionRecorder *recorder);
+    QByteArray frame(QByteArray data) const;
+    qint64 write(const QByteArray &data);
+    qint64 write(const char *data, qint64 length);
+    qint64 sendLine(QString line);
+    void clearInput();
+    void clearOutput();
+    quint64 bytesSent() const;
+    quint64 bytesReceived() const;
+    QString metrics() const;
+    PortWatcher *portWatcher() const;
+    bool isReconnecting() const;
+public slots:
+    void setAutoReconnect(bool enabled);
+    void setPortFilter(QString filter);
+signals:
+    void dataReceived(QByteArray data);
+    void bytesWritten(qint64 bytes);
+    void connectionLost(QString error);
+    void reconnected(QString portName);
+private slots:
+    void handleError(QSerialPort::SerialPortError error);
+    void tryReconnect();
+    void readData();
+    void deliverData();
+    void dataWritten(qint64 bytes);
+private:
+    QSerialPort *serial;
+    SessionRecorder *recorder;
+    int lineTermination;
+    //received bytes are delivered at most once per interval
+    int receiveInterval;
+    QTimer *receiveTimer;
+    QByteArray receiveBuffer;
+    quint64 sentCount;
+    quint64 receivedCount;
+    QElapsedTimer sessionTimer;
+    //last opened board, reopened when it is plugged again
+    PortWatcher *watcher;
+    bool autoReconnect;
+    bool reconnectPending;
+    QTimer *reconnectTimer;
+    QString lastPortName;
+    QString lastSerialNumber;
+    qint32 lastBaudRate;
+    QSerialPort::FlowControl lastFlowControl;
+    void closePort();
+};
+
+#endif // SERIALSESSION_H
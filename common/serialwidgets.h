@@ -0,0 +1,80 @@
+/*
+ * Serial widgets helpers for arduino tools
+ *
+ * Copyright 2024 Gabriel Dimitriu
+ *
+ * This file is part of arduino_qt_tools project.
+
+ * arduino_qt_tools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * arduino_qt_tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with arduino_qt_tools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+
+#ifndef SERIALWIDGETS_H
+#define SERIALWIDGETS_H
+
+#include <QComboBox>
+#include "portwatcher.h"
+#include "serialsession.h"
+
+/*
+ * Fill the combo boxes of the tools, header only so that the serial
+ * library does not depend on the widgets.
+ */
+class SerialWidgets
+{
+public:
+    static void addBaudRates(QComboBox *comboBox)
+    {
+        comboBox->addItem("2400");
+        comboBox->addItem("4800");
+        comboBox->addItem("9600");
+        comboBox->addItem("19200");
+        comboBox->addItem("38400");
+        comboBox->addItem("57600");
+        comboBox->addItem("115200");
+    }
+
+    static void addLineTerminations(QComboBox *comboBox)
+    {
+        comboBox->addItem("None", SerialSession::NONE);
+        comboBox->addItem("LF", SerialSession::LF);
+        comboBox->addItem("CR", SerialSession::CR);
+        comboBox->addItem("CR&LF", SerialSession::CR_LF);
+    }
+
+    //keep the selected port, or the typed one, when the list changes
+    static void updatePortList(QComboBox *comboBox, const QList<QSerialPortInfo> &ports)
+    {
+        QString current = comboBox->currentText();
+        comboBox->clear();
+        foreach (const QSerialPortInfo &info, ports)
+        {
+            comboBox->addItem(info.portName());
+        }
+        int index = comboBox->findText(current);
+        if ( index >= 0 )
+            comboBox->setCurrentIndex(index);
+        else if ( comboBox->isEditable() )
+            comboBox->setEditText(current);
+    }
+
+    static void bindPortList(PortWatcher *watcher, QComboBox *comboBox)
+    {
+        QObject::connect(watcher, &PortWatcher::portsChanged, comboBox, [watcher, comboBox]() {
+            updatePortList(comboBox, watcher->ports());
+        });
+    }
+};
+
+#endif // SERIALWIDGETS_H
@@ -0,0 +1,164 @@
+/*
+ * Record and replay of serial sessions for arduino tools
+ *
+ * Copyright 2024 Gabriel Dimitriu
+ *
+ * This file is part of arduino_qt_tools project.
+
+ * arduino_qt_tools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * arduino_qt_tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with arduino_qt_tools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+
+#include "sessionrecording.h"
+
+#define RECORDING_MAGIC "AQTR"
+#define RECORDING_VERSION 1
+
+static void appendVarint(QByteArray &buffer, quint64 value)
+{
+    while ( value >= 0x80 )
+    {
+        buffer.append(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    buffer.append(static_cast<char>(value));
+}
+
+SessionRecorder::SessionRecorder()
+{
+    lastTime = 0;
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    stop();
+}
+
+bool SessionRecorder::start(QString fileName)
+{
+    stop();
+    file.setFileName(fileName);
+    if ( !file.open(QIODevice::WriteOnly | QIODevice::Truncate) )
+        return false;
+    QByteArray header(RECORDING_MAGIC);
+    header.append(static_cast<char>(RECORDING_VERSION));
+    file.write(header);
+    lastTime = 0;
+    timer.start();
+    return true;
+}
+
+void SessionRecorder::stop()
+{
+    if ( file.isOpen() )
+        file.close();
+}
+
+bool SessionRecorder::isRecording() const
+{
+    return file.isOpen();
+}
+
+QString SessionRecorder::errorString() const
+{
+    return file.errorString();
+}
+
+void SessionRecorder::record(DIRECTION direction, const QByteArray &data)
+{
+    if ( !file.isOpen() || data.isEmpty() )
+        return;
+    qint64 now = timer.nsecsElapsed() / 1000;
+    QByteArray entry;
+    entry.append(static_cast<char>(direction));
+    appendVarint(entry, now - lastTime);
+    appendVarint(entry, data.size());
+    entry.append(data);
+    file.write(entry);
+    lastTime = now;
+}
+
+SessionReader::SessionReader()
+{
+    time = 0;
+}
+
+bool SessionReader::open(QString fileName)
+{
+    file.setFileName(fileName);
+    if ( !file.open(QIODevice::ReadOnly) )
+    {
+        error = file.errorString();
+        return false;
+    }
+    QByteArray header = file.read(5);
+    if ( header.size() != 5 || !header.startsWith(RECORDING_MAGIC) || header[4] != RECORDING_VERSION )
+    {
+        error = QString("%1 is not a session recording").arg(fileName);
+        file.close();
+        return false;
+    }
+    time = 0;
+    return true;
+}
+
+bool SessionReader::next(SessionRecord &record)
+{
+    char direction;
+    if ( !file.getChar(&direction) )
+        return false;
+    quint64 delta;
+    quint64 length;
+    if ( !readVarint(delta) || !readVarint(length) )
+        return false;
+    if ( length > static_cast<quint64>(file.size() - file.pos()) )
+    {
+        error = QString("truncated recording");
+        return false;
+    }
+    record.data = file.read(static_cast<qint64>(length));
+    if ( static_cast<quint64>(record.data.size()) != length )
+    {
+        error = QString("truncated recording");
+        return false;
+    }
+    time += delta;
+    record.direction = direction;
+    record.time = time;
+    return true;
+}
+
+QString SessionReader::errorString() const
+{
+    return error;
+}
+
+bool SessionReader::readVarint(quint64 &value)
+{
+    value = 0;
+    for ( int shift = 0; shift < 64; shift += 7 )
+    {
+        char byte;
+        if ( !file.getChar(&byte) )
+        {
+            error = QString("truncated recording");
+            return false;
+        }
+        value |= static_cast<quint64>(byte & 0x7F) << shift;
+        if ( !(byte & 0x80) )
+            return true;
+    }
+    error = QString("invalid recording");
+    return false;
+}
@@ -0,0 +1,79 @@
+/*
+ * Record and replay of serial sessions for arduino tools
+ *
+ * Copyright 2024 Gabriel Dimitriu
+ *
+ * This file is part of arduino_qt_tools project.
+
+ * arduino_qt_tools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * arduino_qt_tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with arduino_qt_tools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+
+#ifndef SESSIONRECORDING_H
+#define SESSIONRECORDING_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+/*
+ * Recording file: the magic "AQTR", a version byte and then one record
+ * for each read or write of the session:
+ *   direction byte, I received from the board or O sent to the board
+ *   time since the previous record in microseconds, varint
+ *   length of the data, varint
+ *   data
+ * Varints are 7 bits per byte, low bits first, high bit set when more follow.
+ */
+struct SessionRecord
+{
+    char direction;
+    //microseconds since the start of the recording
+    qint64 time;
+    QByteArray data;
+};
+
+class SessionRecorder
+{
+public:
+    enum DIRECTION { RECEIVED = 'I', SENT = 'O' };
+    SessionRecorder();
+    ~SessionRecorder();
+    bool start(QString fileName);
+    void stop();
+    bool isRecording() const;
+    QString errorString() const;
+    void record(DIRECTION direction, const QByteArray &data);
+private:
+    QFile file;
+    QElapsedTimer timer;
+    qint64 lastTime;
+};
+
+class SessionReader
+{
+public:
+    SessionReader();
+    bool open(QString fileName);
+    bool next(SessionRecord &record);
+    QString errorString() const;
+private:
+    QFile file;
+    qint64 time;
+    QString error;
+    bool readVarint(quint64 &value);
+};
+
+#endif // SESSIONRECORDING_H
@@ -0,0 +1,11 @@
+# Sources of the library shared by the arduino tools
+
+SOURCES += \
+        $$PWD/portwatcher.cpp \
+        $$PWD/serialsession.cpp \
+        $$PWD/sessionrecording.cpp
+
+HEADERS += \
+        $$PWD/portwatcher.h \
+        $$PWD/serialsession.h \
+        $$PWD/sessionrecording.h
@@ -32,3 +32,5 @@ HEADERS += \
 
 FORMS += \
         readwriteeeprom.ui
+
+include(../common/common.pri)
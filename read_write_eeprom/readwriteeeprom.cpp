@@ -24,7 +24,39 @@
 #include "ui_readwriteeeprom.h"
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QStatusBar>
 #include <QtSerialPort/QSerialPortInfo>
+#include <QFile>
+#include <QTextStream>
+#include <QCryptographicHash>
+#include <QVector>
+#include <QPair>
+#include <algorithm>
+
+//number of times a chunk is sent again before the transfer is paused
+#define MAX_CHUNK_RETRIES 3
+//the arduino resets when the port is opened, wait for the sketch to start
+#define BOOT_DELAY 2000
+//one Wire transaction of an AVR board, the chunk limit until the sketch reports its payload
+#define SAFE_PAYLOAD 31
+
+//same crc32 as the hash command of the sketch
+static quint32 crc32(const QByteArray &data)
+{
+    quint32 crc = 0xFFFFFFFF;
+    for ( int idx = 0; idx < data.size(); idx++ )
+    {
+        crc ^= static_cast<unsigned char>(data[idx]);
+        for ( int bit = 0; bit < 8; bit++ )
+        {
+            if ( crc & 1 )
+                crc = (crc >> 1) ^ 0xEDB88320;
+            else
+                crc = crc >> 1;
+        }
+    }
+    return ~crc;
+}
 
 ReadWriteEEPROM::ReadWriteEEPROM(QWidget *parent) :
     QMainWindow(parent),
@@ -47,7 +79,44 @@ ReadWriteEEPROM::~ReadWriteEEPROM()
 
 void ReadWriteEEPROM::setupComs()
 {
-    serial = nullptr;
+    session = new SerialSession(this);
+    connect(session, SIGNAL(dataReceived(QByteArray)), this, SLOT(readDataToViewOrDump(QByteArray)));
+    connect(session, SIGNAL(connectionLost(QString)), this, SLOT(handleError(QString)));
+    connect(ui->lineTermination, SIGNAL(currentIndexChanged(int)), this, SLOT(changedLineTermination(int)));
+    //the session reopens the board when it is plugged again
+    connect(session, SIGNAL(reconnected(QString)), this, SLOT(boardReconnected(QString)));
+    connect(ui->portFilter, SIGNAL(textChanged(QString)), session, SLOT(setPortFilter(QString)));
+    connect(ui->autoReconnect, SIGNAL(toggled(bool)), session, SLOT(setAutoReconnect(bool)));
+    ui->autoReconnect->setChecked(true);
+    session->setAutoReconnect(ui->autoReconnect->isChecked());
+    SerialWidgets::bindPortList(session->portWatcher(), ui->comPorts);
+    transferType = NO_TRANSFER;
+    transferAddress = 0;
+    transferLength = 0;
+    transferDone = 0;
+    transferChunk = 0;
+    transferRetries = 0;
+    transferPaused = false;
+    transferHash = 0;
+    pausedDone = 0;
+    negotiating = false;
+    deviceMaxPayload = 0;
+    chunkSize = 0;
+    lastThroughput = 0;
+    growCooldown = 0;
+    transferTimer = new QTimer(this);
+    transferTimer->setSingleShot(true);
+    connect(transferTimer, SIGNAL(timeout()), this, SLOT(transferTimeout()));
+    negotiateTimer = new QTimer(this);
+    negotiateTimer->setSingleShot(true);
+    negotiateTimer->setInterval(2000);
+    connect(negotiateTimer, SIGNAL(timeout()), this, SLOT(negotiateTimeout()));
+    //the buffer is negotiated once the sketch has started after a connect
+    resumeAfterBoot = false;
+    bootTimer = new QTimer(this);
+    bootTimer->setSingleShot(true);
+    bootTimer->setInterval(BOOT_DELAY);
+    connect(bootTimer, SIGNAL(timeout()), this, SLOT(boardBooted()));
     connect(ui->connectButton, SIGNAL(clicked(bool)), this, SLOT(connectSerial()));
     connect(ui->disconnectButton, SIGNAL(clicked(bool)), this, SLOT(disconnectSerial()));
     ui->statusLine->setText("Disconnected");
@@ -60,36 +129,28 @@ void ReadWriteEEPROM::setupComs()
     connect(ui->writeButton, SIGNAL(clicked(bool)), this, SLOT(sendWriteCommand()));
     ui->bufferSize->setText("512");
     connect(ui->setBuffer, SIGNAL(clicked(bool)), this, SLOT(sendBufferSizeCommand()));
+    connect(ui->negotiateBuffer, SIGNAL(clicked(bool)), this, SLOT(sendNegotiateCommand()));
 }
 
 void ReadWriteEEPROM::setupCommComboBoxDefault()
 {
-    //setup line termination
-    ui->lineTermination->addItem("None", LINE_TERMINATION::NONE);
-    ui->lineTermination->addItem("LF", LINE_TERMINATION::LF);
-    ui->lineTermination->addItem("CR", LINE_TERMINATION::CR);
-    ui->lineTermination->addItem("LF&CR", LINE_TERMINATION::LF_CR);
-    //setup boud rate
-    ui->boudRate->addItem("2400");
-    ui->boudRate->addItem("4800");
-    ui->boudRate->addItem("9600");
-    ui->boudRate->addItem("19200");
-    ui->boudRate->addItem("38400");
-    ui->boudRate->addItem("57600");
-    ui->boudRate->addItem("115200");
+    //setup line termination and boud rate
+    SerialWidgets::addLineTerminations(ui->lineTermination);
+    SerialWidgets::addBaudRates(ui->boudRate);
 }
 
 void ReadWriteEEPROM::setupEproms()
 {
-    //setup eprom type
-    ui->eepromType->addItem("AT24Cxxx");
-    ui->eepromType->addItem("24C02C");
-    ui->eepromType->addItem("FM24C02");
+    //setup eprom type with the page size of the chip
+    ui->eepromType->addItem("AT24Cxxx", 64);
+    ui->eepromType->addItem("24C02C", 16);
+    ui->eepromType->addItem("FM24C02", 8);
     connect(ui->eepromType, SIGNAL(currentIndexChanged(int)), this, SLOT(selectEpromType(int)));
     ui->epromSize->addItem("128k",16384);
     ui->epromSize->addItem("256k",32768);
     ui->address->setText("0");
     ui->allBytes->setChecked(true);
+    ui->skipIdentical->setChecked(true);
 }
 
 void ReadWriteEEPROM::selectEpromType(int index)
@@ -153,65 +214,108 @@ void ReadWriteEEPROM::writeOpenFile()
 
 void ReadWriteEEPROM::changedBoudRate(int index)
 {
-    if ( serial != nullptr && serial->isOpen() )
-    {
-        serial->setBaudRate(ui->boudRate->currentText().toInt());
-    }
+    session->setBaudRate(ui->boudRate->itemText(index).toInt());
 }
 
 
 void ReadWriteEEPROM::connectSerial()
 {
-    if (serial != nullptr && serial->isOpen() )
+    if ( openSerial() )
     {
-        serial->close();
-        delete serial;
-    } else if ( serial != nullptr )
+        bool resume = false;
+        if ( transferType != NO_TRANSFER && transferPaused )
+        {
+            QString question = tr("Resume the interrupted transfer from address %1?").arg(transferAddress + transferDone);
+            if ( QMessageBox::question(this, tr("Resume transfer"), question, QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes )
+            {
+                resume = true;
+            } else {
+                transferType = NO_TRANSFER;
+            }
+        }
+        waitForBoot(resume);
+    }
+    ui->connectButton->clearFocus();
+}
+
+/*
+ * The arduino resets when the port is opened, the buffer is negotiated
+ * after BOOT_DELAY and the paused transfer resumed after the negotiation.
+ */
+void ReadWriteEEPROM::waitForBoot(bool resume)
+{
+    deviceMaxPayload = 0;
+    resumeAfterBoot = resume;
+    bootTimer->start();
+}
+
+void ReadWriteEEPROM::boardBooted()
+{
+    if ( !session->isOpen() )
+        return;
+    //a transfer started while waiting keeps the safe chunk size
+    if ( ( transferType != NO_TRANSFER && !transferPaused ) || negotiating )
+        return;
+    startNegotiation();
+}
+
+bool ReadWriteEEPROM::openSerial()
+{
+    if ( transferType != NO_TRANSFER && !transferPaused )
     {
-        delete serial;
+        transferTimer->stop();
+        transferPaused = true;
     }
     QString portName = ui->comPorts->currentText();
     if ( portName.isEmpty() )
-        return;
-    serial = new QSerialPort(this);
-    serial->setPortName(portName);
-    serial->setBaudRate(ui->boudRate->currentText().toInt());
-    serial->setDataBits(QSerialPort::Data8);
-    serial->setParity(QSerialPort::NoParity);
-    serial->setStopBits(QSerialPort::OneStop);
-    serial->setFlowControl(QSerialPort::NoFlowControl);
-    connect(serial, SIGNAL(error(QSerialPort::SerialPortError)), this,
-            SLOT(handleError(QSerialPort::SerialPortError)));
-    if (serial->open(QIODevice::ReadWrite))
-    {
-        serial->setDataTerminalReady(true);
+        return false;
+    session->setLineTermination(ui->lineTermination->currentData().toInt());
+    if ( session->open(portName, ui->boudRate->currentText().toInt()) )
+    {
         ui->statusLine->setText("Connected");
+        return true;
     }
-    ui->connectButton->clearFocus();
+    return false;
 }
 
 void ReadWriteEEPROM::disconnectSerial()
 {
-    if ( serial != nullptr )
+    interruptTransfer();
+    if ( session->isOpen() )
     {
         ui->statusLine->setText("Disconnected");
-        disconnect(serial, SIGNAL(error(QSerialPort::SerialPortError)), this,
-               SLOT(handleError(QSerialPort::SerialPortError)));
-        serial->close();
-        delete serial;
-        serial = nullptr;
     }
+    bootTimer->stop();
+    resumeAfterBoot = false;
+    session->close();
     ui->disconnectButton->clearFocus();
+}
+
+void ReadWriteEEPROM::interruptTransfer()
+{
+    if ( transferType != NO_TRANSFER && !transferPaused )
+    {
+        //keep the job so it could be resumed from the last completed chunk
+        transferTimer->stop();
+        transferPaused = true;
+        logMessage(tr("Transfer interrupted at address %1").arg(transferAddress + transferDone));
+    }
     if ( outFile.is_open() ) {
         outFile.close();
     }
 }
 
 
-void ReadWriteEEPROM::handleError(QSerialPort::SerialPortError error)
+void ReadWriteEEPROM::handleError(QString error)
 {
-    if (error == QSerialPort::ResourceError) {
-        QMessageBox::critical(this, tr("Critical Error"), serial->errorString());
+    if ( session->isReconnecting() )
+    {
+        //the board was unplugged or reset, the session waits for it to come back
+        logMessage(tr("Connection lost: ") + error);
+        interruptTransfer();
+        ui->statusLine->setText("Waiting for board");
+    } else {
+        QMessageBox::critical(this, tr("Critical Error"), error);
         disconnectSerial();
     }
 }
@@ -219,22 +323,31 @@ void ReadWriteEEPROM::handleError(QSerialPort::SerialPortError error)
 
 void ReadWriteEEPROM::detectPorts()
 {
-    ui->comPorts->clear();
-    foreach (const QSerialPortInfo &info, QSerialPortInfo::availablePorts())
+    //the list is kept up to date by the port watcher, print only a summary
+    foreach (const QSerialPortInfo &info, session->portWatcher()->ports())
     {
-        QString infoData = QObject::tr("Port: ") + info.portName() + "\n"
-                    + QObject::tr("Location: ") + info.systemLocation() + "\n"
-                    + QObject::tr("Description: ") + info.description() + "\n"
-                    + QObject::tr("Manufacturer: ") + info.manufacturer() + "\n"
-                    + QObject::tr("Serial number: ") + info.serialNumber() + "\n"
-                    + QObject::tr("Busy: ") + (info.isBusy() ? QObject::tr("Yes") : QObject::tr("No")) + "\n"
-                    + "-------------------------------------------\n";
-        ui->logView->moveCursor(QTextCursor::End);
-        ui->logView->insertPlainText(infoData);
-        ui->comPorts->addItem(info.portName());
+        logMessage(PortWatcher::describe(info));
     }
+    session->portWatcher()->rescan();
     ui->detectComs->clearFocus();
-    QMainWindow::repaint();
+}
+
+void ReadWriteEEPROM::boardReconnected(QString portName)
+{
+    int index = ui->comPorts->findText(portName);
+    if ( index >= 0 )
+        ui->comPorts->setCurrentIndex(index);
+    else
+        ui->comPorts->setEditText(portName);
+    ui->statusLine->setText("Connected");
+    bool resume = transferType != NO_TRANSFER && transferPaused;
+    if ( resume )
+    {
+        logMessage(tr("Board reconnected on %1, resuming the transfer").arg(portName));
+    } else {
+        logMessage(tr("Board reconnected on %1").arg(portName));
+    }
+    waitForBoot(resume);
 }
 
 void ReadWriteEEPROM::clearLogs()
@@ -251,7 +364,7 @@ void ReadWriteEEPROM::clearReadWrite()
 
 void ReadWriteEEPROM::sendReadCommand()
 {
-    if ( serial == nullptr || !serial->isOpen() )
+    if ( !session->isOpen() )
     {
         QMessageBox::critical(this, tr("First connect to serial."), tr("First connect to serial"), QMessageBox::Ok);
         return;
@@ -261,26 +374,26 @@ void ReadWriteEEPROM::sendReadCommand()
         QMessageBox::critical(this, tr("First complete the device address."), tr("First complete the device address"), QMessageBox::Ok);
         return;
     }
-    disconnect(serial, SIGNAL(readyRead()), this, SLOT(readDataToViewOrDump()));
-    connect(serial, SIGNAL(readyRead()), this, SLOT(readDataToViewOrDump()));
-    QString str;
-    //read one byte
-    if ( ui->length->text().isEmpty() )
+    if ( ( transferType != NO_TRANSFER && !transferPaused ) || negotiating )
     {
-        str.push_back('r');
-        str.push_back(ui->deviceAddress->text());
-        str.push_back(',');
-        str.push_back(ui->address->text());
-        str.push_back('#');
-    } else {
-        str.push_back('R');
-        str.push_back(ui->deviceAddress->text());
-        str.push_back(',');
-        str.push_back(ui->address->text());
-        str.push_back(',');
-        str.push_back(ui->length->text());
-        str.push_back('#');
+        QMessageBox::critical(this, tr("Transfer in progress."), tr("Wait for the current transfer to finish"), QMessageBox::Ok);
+        return;
     }
+    //read multiple bytes in chunks
+    if ( !ui->length->text().isEmpty() )
+    {
+        dumpFileName = ui->outFileName->text();
+        startTransfer(READ_TRANSFER, ui->deviceAddress->text(), ui->address->text().toLong(), ui->length->text().toLong());
+        ui->readButton->clearFocus();
+        return;
+    }
+    //read one byte
+    QString str;
+    str.push_back('r');
+    str.push_back(ui->deviceAddress->text());
+    str.push_back(',');
+    str.push_back(ui->address->text());
+    str.push_back('#');
     if ( !ui->outFileName->text().isEmpty() )
     {
         if ( outFile.is_open() ) {
@@ -288,35 +401,66 @@ void ReadWriteEEPROM::sendReadCommand()
         }
         outFile.open(ui->outFileName->text().toStdString().c_str(), std::ios::trunc);
     }
-    switch ( ui->lineTermination->currentData().toInt() )
-    {
-    case LINE_TERMINATION::NONE :
-        serial->write(str.toLatin1());
-        break;
-    case LINE_TERMINATION::LF :
-        str.append('\n');
-        serial->write(str.toLatin1());
-        break;
-    case LINE_TERMINATION::CR :
-        str.append('\r');
-        serial->write(str.toLatin1());
-        break;
-    case LINE_TERMINATION::LF_CR :
-        str.append("\n\r");
-        serial->write(str.toLatin1());
-        break;
-    default:
-        serial->write(str.toLatin1());
-    }
+    sendCommand(str);
     ui->readButton->clearFocus();
 }
 
-void ReadWriteEEPROM::readDataToViewOrDump()
+void ReadWriteEEPROM::readDataToViewOrDump(QByteArray data)
 {
-    QString readData = QString::fromStdString(serial->readAll().toStdString());
+    if ( negotiating )
+    {
+        infoBuffer.append(data);
+        if ( infoBuffer.contains('#') )
+        {
+            deviceInfoReceived();
+        }
+        return;
+    }
+    if ( transferType == READ_TRANSFER && !transferPaused )
+    {
+        //the sketch sends the data followed by its crc32 in hex and #
+        chunkBuffer.append(data);
+        int end = chunkBuffer.indexOf('#', transferChunk);
+        if ( end < 0 )
+            return;
+        bool ok;
+        quint32 hash = chunkBuffer.mid(transferChunk, end - transferChunk).toUInt(&ok, 16);
+        chunkBuffer.truncate(transferChunk);
+        if ( ok && hash == crc32(chunkBuffer) )
+        {
+            chunkCompleted();
+        } else {
+            //late bytes of a chunk sent before would end here
+            retryChunk(tr("Corrupted chunk at address %1, retrying"));
+        }
+        return;
+    }
+    if ( transferType == HASH_TRANSFER && !transferPaused )
+    {
+        chunkBuffer.append(data);
+        if ( chunkBuffer.contains('#') )
+        {
+            deviceHashReceived();
+        }
+        return;
+    }
+    if ( transferType == WRITE_TRANSFER && !transferPaused )
+    {
+        //the sketch acknowledges each written chunk with K# or rejects it with E#
+        chunkBuffer.append(data);
+        if ( chunkBuffer.contains("K#") )
+        {
+            chunkCompleted();
+        }
+        else if ( chunkBuffer.contains("E#") )
+        {
+            retryChunk(tr("Write failed at address %1, retrying"));
+        }
+        return;
+    }
+    QString readData = QString::fromStdString(data.toStdString());
     ui->readWriteView->moveCursor(QTextCursor::End);
     ui->readWriteView->insertPlainText(readData);
-    serial->flush();
     if ( outFile.is_open() )
     {
         outFile<<readData.toLatin1().toStdString();
@@ -327,7 +471,7 @@ void ReadWriteEEPROM::readDataToViewOrDump()
 
 void ReadWriteEEPROM::sendWriteCommand()
 {
-    if ( serial == nullptr || !serial->isOpen() )
+    if ( !session->isOpen() )
     {
         QMessageBox::critical(this, tr("First connect to serial."), tr("First connect to serial"), QMessageBox::Ok);
         return;
@@ -337,6 +481,11 @@ void ReadWriteEEPROM::sendWriteCommand()
         QMessageBox::critical(this, tr("First complete the device address."), tr("First complete the device address"), QMessageBox::Ok);
         return;
     }
+    if ( ( transferType != NO_TRANSFER && !transferPaused ) || negotiating )
+    {
+        QMessageBox::critical(this, tr("Transfer in progress."), tr("Wait for the current transfer to finish"), QMessageBox::Ok);
+        return;
+    }
     if ( ui->onlyByte->isChecked() )
     {
         QString command;
@@ -348,26 +497,29 @@ void ReadWriteEEPROM::sendWriteCommand()
         command.push_back(getByteFromString(ui->dataToSend->text()));
         command.push_back('#');
         sendCommand(command);
-    } else if ( ui->inFileName->text().isEmpty() ){
-        if ( ui->dataToSend->text().length() <= ui->bufferSize->text().toLong() ) {
-            sendWriteMultiple(ui->deviceAddress->text(), ui->address->text().toLong(), ui->dataToSend->text().length(), 0);
-        }
-        else
+    } else {
+        if ( ui->inFileName->text().isEmpty() )
         {
-            long bufferSize = ui->bufferSize->text().toLong();
-            long length = ui->dataToSend->text().length();
-            long currentIndex = 0;
-            long currentAddress = 0;
-            while ( ( currentIndex + bufferSize) <= length )
-            {
-                sendWriteMultiple(ui->deviceAddress->text(), currentAddress, bufferSize, currentIndex);
-                currentIndex += bufferSize;
-                currentAddress += bufferSize;
-            }
-            if ( ( currentIndex + bufferSize) > length )
+            transferData = ui->dataToSend->text().toLatin1();
+        } else {
+            QFile inFile(ui->inFileName->text());
+            if ( !inFile.open(QIODevice::ReadOnly) )
             {
-                sendWriteMultiple(ui->deviceAddress->text(), currentAddress, length - currentIndex, currentIndex);
+                QMessageBox::critical(this, tr("Could not open file to send to EEPROM."), inFile.errorString(), QMessageBox::Ok);
+                return;
             }
+            transferData = inFile.readAll();
+            inFile.close();
+        }
+        if ( !transferData.isEmpty() && ui->skipIdentical->isChecked() )
+        {
+            //ask the sketch for the hash first, the write is skipped if it matches
+            transferHash = crc32(transferData);
+            startTransfer(HASH_TRANSFER, ui->deviceAddress->text(), ui->address->text().toLong(), transferData.size());
+        }
+        else if ( !transferData.isEmpty() )
+        {
+            startTransfer(WRITE_TRANSFER, ui->deviceAddress->text(), ui->address->text().toLong(), transferData.size());
         }
     }
     ui->writeButton->clearFocus();
@@ -384,7 +536,20 @@ void ReadWriteEEPROM::sendWriteMultiple(QString deviceAddress, long address, lon
     command.push_back(QString::number(length));
     command.push_back('#');
     sendCommand(command);
-    serial->write(ui->dataToSend->text().mid(startPos, startPos + length).toLatin1());
+    session->write(transferData.mid(startPos, length));
+}
+
+void ReadWriteEEPROM::sendReadMultiple(QString deviceAddress, long address, long length)
+{
+    QString command;
+    command.push_back('R');
+    command.push_back(deviceAddress);
+    command.push_back(',');
+    command.push_back(QString::number(address));
+    command.push_back(',');
+    command.push_back(QString::number(length));
+    command.push_back('#');
+    sendCommand(command);
 }
 
 unsigned char ReadWriteEEPROM::getByteFromString(QString str)
@@ -402,26 +567,7 @@ unsigned char ReadWriteEEPROM::getByteFromString(QString str)
 
 void ReadWriteEEPROM::sendCommand(QString command)
 {
-    switch ( ui->lineTermination->currentData().toInt() )
-    {
-    case LINE_TERMINATION::NONE :
-        serial->write(command.toLatin1());
-        break;
-    case LINE_TERMINATION::LF :
-        command.append('\n');
-        serial->write(command.toLatin1());
-        break;
-    case LINE_TERMINATION::CR :
-        command.append('\r');
-        serial->write(command.toLatin1());
-        break;
-    case LINE_TERMINATION::LF_CR :
-        command.append("\n\r");
-        serial->write(command.toLatin1());
-        break;
-    default:
-        serial->write(command.toLatin1());
-    }
+    session->sendLine(command);
 }
 
 void ReadWriteEEPROM::sendBufferSizeCommand()
@@ -433,3 +579,457 @@ void ReadWriteEEPROM::sendBufferSizeCommand()
     sendCommand(command);
     ui->setBuffer->clearFocus();
 }
+
+void ReadWriteEEPROM::logMessage(QString message)
+{
+    ui->logView->moveCursor(QTextCursor::End);
+    ui->logView->insertPlainText(message + "\n");
+}
+
+/*
+ * Transfers are split in chunks of buffer size, each chunk is sent only
+ * after the previous one was received with a matching crc32 (read) or
+ * acknowledged by the sketch (write). Completed chunks are recorded into a journal
+ * next to the dump/input file so an interrupted job continues from the
+ * last completed chunk instead of address 0.
+ */
+void ReadWriteEEPROM::startTransfer(TRANSFER_TYPE type, QString deviceAddress, long address, long length)
+{
+    transferTimer->stop();
+    //a paused job started again continues where it stopped, also without a journal
+    if ( transferType != NO_TRANSFER && transferType != HASH_TRANSFER && transferPaused )
+    {
+        pausedJob = transferKey;
+        pausedDone = transferDone;
+    }
+    if ( outFile.is_open() ) {
+        outFile.close();
+    }
+    transferType = type;
+    transferDevice = deviceAddress;
+    transferAddress = address;
+    transferLength = length;
+    transferRetries = 0;
+    transferPaused = false;
+    chunkBuffer.clear();
+    chunkSize = 0;
+    lastThroughput = 0;
+    growCooldown = 0;
+    if ( type == READ_TRANSFER )
+        journalName = dumpFileName.isEmpty() ? QString() : dumpFileName + ".journal";
+    else if ( type == HASH_TRANSFER )
+        journalName = QString();
+    else
+        journalName = ui->inFileName->text().isEmpty() ? QString() : ui->inFileName->text() + ".journal";
+    transferKey = journalHeader();
+    long journalDone = loadJournal();
+    transferDone = journalDone;
+    if ( type != HASH_TRANSFER )
+    {
+        if ( transferKey == pausedJob )
+            transferDone = qMax(transferDone, pausedDone);
+        pausedJob.clear();
+    }
+    if ( type == READ_TRANSFER && !dumpFileName.isEmpty() && !openDumpFile(transferDone > 0) )
+    {
+        //the partial dump is gone so the journal is useless
+        transferDone = 0;
+    }
+    if ( transferDone > 0 )
+    {
+        logMessage(tr("Resuming transfer from address %1").arg(transferAddress + transferDone));
+        if ( transferDone > journalDone )
+        {
+            resetJournal();
+            appendJournal(0, transferDone);
+        }
+    } else {
+        resetJournal();
+    }
+    sendNextChunk();
+}
+
+void ReadWriteEEPROM::resumeTransfer()
+{
+    //a new transfer could have been started while waiting for the sketch to boot
+    if ( transferType == NO_TRANSFER || !transferPaused )
+        return;
+    transferPaused = false;
+    transferRetries = 0;
+    chunkBuffer.clear();
+    if ( transferType == READ_TRANSFER && !dumpFileName.isEmpty() && !openDumpFile(true) )
+    {
+        transferDone = 0;
+        resetJournal();
+    }
+    logMessage(tr("Resuming transfer from address %1").arg(transferAddress + transferDone));
+    sendNextChunk();
+}
+
+void ReadWriteEEPROM::sendNextChunk()
+{
+    if ( !session->isOpen() )
+    {
+        transferPaused = true;
+        return;
+    }
+    if ( transferDone >= transferLength )
+    {
+        finishTransfer();
+        return;
+    }
+    transferChunk = qMin(currentChunkSize(), transferLength - transferDone);
+    if ( transferType == WRITE_TRANSFER )
+    {
+        //the eeprom wraps a write at the end of the page, stop the chunk there
+        long page = pageSize();
+        transferChunk = qMin(transferChunk, page - (transferAddress + transferDone) % page);
+    }
+    chunkBuffer.clear();
+    if ( transferType == HASH_TRANSFER )
+    {
+        //the whole image is hashed by the sketch, about 10 bytes per ms on the I2C bus
+        QString command;
+        command.push_back('H');
+        command.push_back(transferDevice);
+        command.push_back(',');
+        command.push_back(QString::number(transferAddress));
+        command.push_back(',');
+        command.push_back(QString::number(transferLength));
+        command.push_back('#');
+        sendCommand(command);
+        transferTimer->start(transferLength / 10 + 2000);
+        statusBar()->showMessage(tr("Checking the EEPROM content"));
+        return;
+    }
+    if ( transferType == READ_TRANSFER )
+        sendReadMultiple(transferDevice, transferAddress + transferDone, transferChunk);
+    else
+        sendWriteMultiple(transferDevice, transferAddress + transferDone, transferChunk, transferDone);
+    chunkTimer.start();
+    //time on the wire for 10 bits per byte plus a margin for the eeprom
+    transferTimer->start(transferChunk * 10000 / session->baudRate() + transferChunk + 1000);
+    statusBar()->showMessage(tr("Transferred %1 of %2 bytes, chunk %3").arg(transferDone).arg(transferLength).arg(transferChunk));
+}
+
+void ReadWriteEEPROM::chunkCompleted()
+{
+    transferTimer->stop();
+    if ( transferType == READ_TRANSFER )
+    {
+        ui->readWriteView->moveCursor(QTextCursor::End);
+        ui->readWriteView->insertPlainText(QString::fromLatin1(chunkBuffer));
+        if ( outFile.is_open() )
+        {
+            outFile.seekp(transferDone);
+            outFile.write(chunkBuffer.constData(), chunkBuffer.size());
+            outFile.flush();
+        }
+    }
+    appendJournal(transferDone, transferChunk);
+    transferDone += transferChunk;
+    transferRetries = 0;
+    adaptChunkSize(false);
+    sendNextChunk();
+}
+
+void ReadWriteEEPROM::transferTimeout()
+{
+    if ( transferType == NO_TRANSFER || transferPaused )
+        return;
+    if ( transferType == HASH_TRANSFER )
+    {
+        //sketch without hash support, write everything; a late answer of a
+        //slow sketch is dropped and could not be taken as a write ack
+        logMessage(tr("No hash received from the sketch, writing the image"));
+        session->clearInput();
+        startTransfer(WRITE_TRANSFER, transferDevice, transferAddress, transferLength);
+        return;
+    }
+    retryChunk(tr("Timeout at address %1, retrying"));
+}
+
+/*
+ * The chunk is sent again with a smaller size, after a few failures in
+ * a row the transfer is paused.
+ */
+void ReadWriteEEPROM::retryChunk(QString message)
+{
+    transferTimer->stop();
+    if ( ++transferRetries > MAX_CHUNK_RETRIES )
+    {
+        transferPaused = true;
+        logMessage(tr("Transfer stopped at address %1, start it again to resume").arg(transferAddress + transferDone));
+        return;
+    }
+    logMessage(message.arg(transferAddress + transferDone));
+    adaptChunkSize(true);
+    session->clearInput();
+    sendNextChunk();
+}
+
+void ReadWriteEEPROM::finishTransfer()
+{
+    transferTimer->stop();
+    if ( outFile.is_open() ) {
+        outFile.close();
+    }
+    if ( !journalName.isEmpty() )
+    {
+        QFile::remove(journalName);
+    }
+    logMessage(tr("Transfer of %1 bytes completed").arg(transferLength));
+    logMessage(session->metrics());
+    statusBar()->showMessage(tr("Transferred %1 of %2 bytes").arg(transferDone).arg(transferLength));
+    transferType = NO_TRANSFER;
+    transferData.clear();
+    chunkBuffer.clear();
+    QMainWindow::repaint();
+}
+
+bool ReadWriteEEPROM::openDumpFile(bool resume)
+{
+    if ( outFile.is_open() ) {
+        outFile.close();
+    }
+    std::string name = dumpFileName.toStdString();
+    if ( resume )
+    {
+        //merge with the partial dump of the interrupted transfer
+        outFile.open(name.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        if ( outFile.is_open() )
+            return true;
+    }
+    outFile.open(name.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+    return !resume;
+}
+
+QString ReadWriteEEPROM::journalHeader()
+{
+    QString header = QString("%1,%2,%3,%4").arg(transferType == READ_TRANSFER ? 'R' : 'W')
+            .arg(transferDevice).arg(transferAddress).arg(transferLength);
+    if ( transferType == WRITE_TRANSFER )
+    {
+        header.push_back(',');
+        header.push_back(QString(QCryptographicHash::hash(transferData, QCryptographicHash::Md5).toHex()));
+    }
+    return header;
+}
+
+long ReadWriteEEPROM::loadJournal()
+{
+    if ( journalName.isEmpty() )
+        return 0;
+    QFile journal(journalName);
+    if ( !journal.open(QIODevice::ReadOnly | QIODevice::Text) )
+        return 0;
+    QTextStream in(&journal);
+    if ( in.readLine() != journalHeader() )
+        return 0;
+    QVector<QPair<long, long> > ranges;
+    while ( !in.atEnd() )
+    {
+        QStringList range = in.readLine().split(',');
+        if ( range.size() == 2 )
+            ranges.append(qMakePair(range[0].toLong(), range[1].toLong()));
+    }
+    journal.close();
+    std::sort(ranges.begin(), ranges.end());
+    long done = 0;
+    for ( int i = 0; i < ranges.size(); i++ )
+    {
+        if ( ranges[i].first > done )
+            break;
+        done = qMax(done, ranges[i].first + ranges[i].second);
+    }
+    return qMin(done, transferLength);
+}
+
+void ReadWriteEEPROM::resetJournal()
+{
+    if ( journalName.isEmpty() )
+        return;
+    QFile journal(journalName);
+    if ( journal.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text) )
+    {
+        QTextStream out(&journal);
+        out<<journalHeader()<<"\n";
+        journal.close();
+    }
+}
+
+void ReadWriteEEPROM::appendJournal(long offset, long length)
+{
+    if ( journalName.isEmpty() )
+        return;
+    QFile journal(journalName);
+    if ( journal.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text) )
+    {
+        QTextStream out(&journal);
+        out<<offset<<","<<length<<"\n";
+        journal.close();
+    }
+}
+
+void ReadWriteEEPROM::deviceHashReceived()
+{
+    transferTimer->stop();
+    bool ok;
+    quint32 hash = chunkBuffer.left(chunkBuffer.indexOf('#')).trimmed().toUInt(&ok, 16);
+    chunkBuffer.clear();
+    if ( ok && hash == transferHash )
+    {
+        logMessage(tr("EEPROM already contains the image, write skipped"));
+        pausedJob.clear();
+        statusBar()->showMessage(tr("EEPROM already contains the image"));
+        transferType = NO_TRANSFER;
+        transferData.clear();
+        return;
+    }
+    startTransfer(WRITE_TRANSFER, transferDevice, transferAddress, transferLength);
+}
+
+void ReadWriteEEPROM::sendNegotiateCommand()
+{
+    if ( !session->isOpen() )
+    {
+        QMessageBox::critical(this, tr("First connect to serial."), tr("First connect to serial"), QMessageBox::Ok);
+        return;
+    }
+    if ( ( transferType != NO_TRANSFER && !transferPaused ) || negotiating )
+    {
+        QMessageBox::critical(this, tr("Transfer in progress."), tr("Wait for the current transfer to finish"), QMessageBox::Ok);
+        return;
+    }
+    startNegotiation();
+    ui->negotiateBuffer->clearFocus();
+}
+
+void ReadWriteEEPROM::startNegotiation()
+{
+    negotiating = true;
+    infoBuffer.clear();
+    sendCommand("i#");
+    negotiateTimer->start();
+}
+
+void ReadWriteEEPROM::negotiateTimeout()
+{
+    if ( negotiating )
+    {
+        negotiating = false;
+        logMessage(tr("No answer from the sketch to negotiate the buffer, chunks stay at %1 bytes").arg(chunkLimit()));
+        negotiationFinished();
+    }
+}
+
+void ReadWriteEEPROM::negotiationFinished()
+{
+    if ( resumeAfterBoot )
+    {
+        resumeAfterBoot = false;
+        resumeTransfer();
+    }
+}
+
+/*
+ * The sketch answers with I<free ram>,<max payload>#, the payload is
+ * bounded by the Wire buffer. The buffer is set to the largest chunk
+ * which fits in one Wire transaction and does not cross a page.
+ */
+void ReadWriteEEPROM::deviceInfoReceived()
+{
+    negotiating = false;
+    negotiateTimer->stop();
+    QByteArray info = infoBuffer.left(infoBuffer.indexOf('#'));
+    infoBuffer.clear();
+    int start = info.indexOf('I');
+    QList<QByteArray> values = info.mid(start + 1).split(',');
+    if ( start < 0 || values.size() != 2 )
+    {
+        logMessage(tr("Invalid answer from the sketch to negotiate the buffer"));
+        negotiationFinished();
+        return;
+    }
+    long freeRam = values[0].toLong();
+    deviceMaxPayload = values[1].toLong();
+    logMessage(tr("Sketch free RAM %1, max payload %2, page size %3").arg(freeRam).arg(deviceMaxPayload).arg(pageSize()));
+    ui->bufferSize->setText(QString::number(chunkLimit()));
+    sendBufferSizeCommand();
+    negotiationFinished();
+}
+
+long ReadWriteEEPROM::pageSize()
+{
+    long size = ui->eepromType->currentData().toInt();
+    return size > 0 ? size : 8;
+}
+
+/*
+ * Largest power of two which fits in the negotiated payload and in one
+ * page, write chunks are also cut at the end of each page.
+ * Without a negotiation chunks stay within one Wire transaction.
+ */
+long ReadWriteEEPROM::chunkLimit()
+{
+    if ( deviceMaxPayload <= 0 )
+    {
+        long size = ui->bufferSize->text().toLong();
+        return size > 0 && size < SAFE_PAYLOAD ? size : SAFE_PAYLOAD;
+    }
+    long bound = qMin(deviceMaxPayload, pageSize());
+    long limit = 1;
+    while ( limit * 2 <= bound )
+        limit *= 2;
+    return limit;
+}
+
+long ReadWriteEEPROM::currentChunkSize()
+{
+    long size = qMin(ui->bufferSize->text().toLong(), chunkLimit());
+    if ( size <= 0 )
+        size = chunkLimit();
+    if ( !ui->adaptiveChunk->isChecked() )
+        return size;
+    if ( chunkSize <= 0 )
+    {
+        chunkSize = size;
+    }
+    return chunkSize;
+}
+
+/*
+ * Grow the chunk while the throughput does not drop, go back to half on
+ * a drop or on a timeout and keep that size for a few chunks, never
+ * above the chunk limit.
+ */
+void ReadWriteEEPROM::adaptChunkSize(bool error)
+{
+    if ( !ui->adaptiveChunk->isChecked() || chunkSize <= 0 )
+        return;
+    long maximum = chunkLimit();
+    long minimum = qMin(8L, maximum);
+    if ( error )
+    {
+        chunkSize = qMax(minimum, chunkSize / 2);
+        growCooldown = 4;
+        lastThroughput = 0;
+    } else {
+        double throughput = transferChunk / static_cast<double>(qMax<qint64>(chunkTimer.elapsed(), 1));
+        if ( growCooldown > 0 )
+        {
+            growCooldown--;
+        } else if ( throughput < lastThroughput * 0.9 ) {
+            chunkSize = qMax(minimum, chunkSize / 2);
+            growCooldown = 4;
+        } else if ( chunkSize < maximum ) {
+            chunkSize = qMin(maximum, chunkSize * 2);
+        }
+        lastThroughput = throughput;
+    }
+}
+
+void ReadWriteEEPROM::changedLineTermination(int index)
+{
+    session->setLineTermination(ui->lineTermination->itemData(index).toInt());
+}
@@ -27,7 +27,11 @@
 #include <QMenu>
 #include <QAction>
 #include <QSerialPort>
+#include <QTimer>
+#include <QElapsedTimer>
 #include <fstream>
+#include "serialsession.h"
+#include "serialwidgets.h"
 
 namespace Ui {
 class ReadWriteEEPROM;
@@ -44,7 +48,7 @@ private slots:
     void readOpenFile();
     void writeOpenFile();
     void changedBoudRate(int index);
-    void handleError(QSerialPort::SerialPortError error);
+    void handleError(QString error);
     void connectSerial();
     void disconnectSerial();
     void detectPorts();
@@ -52,9 +56,16 @@ private slots:
     void clearReadWrite();
     void selectEpromType(int index);
     void sendReadCommand();
-    void readDataToViewOrDump();
+    void readDataToViewOrDump(QByteArray data);
+    void changedLineTermination(int index);
     void sendWriteCommand();
     void sendBufferSizeCommand();
+    void sendNegotiateCommand();
+    void negotiateTimeout();
+    void boardBooted();
+    void resumeTransfer();
+    void boardReconnected(QString portName);
+    void transferTimeout();
 private:
     QMenu *fileMenu;
 
@@ -64,14 +75,67 @@ private:
     void createMenus();
     void setupComs();
     void setupEproms();
-    enum LINE_TERMINATION { NONE, LF, CR, LF_CR};
     void setupCommComboBoxDefault();
     Ui::ReadWriteEEPROM *ui;
-    QSerialPort *serial;
+    SerialSession *session;
+    bool openSerial();
+    void interruptTransfer();
     std::ofstream outFile;
     unsigned char getByteFromString(QString str);
     void sendCommand(QString command);
     void sendWriteMultiple(QString deviceAddress, long address, long length, long startPos);
+    void sendReadMultiple(QString deviceAddress, long address, long length);
+    //chunked transfers which could be resumed after a disconnect
+    enum TRANSFER_TYPE { NO_TRANSFER, READ_TRANSFER, WRITE_TRANSFER, HASH_TRANSFER };
+    TRANSFER_TYPE transferType;
+    QString transferDevice;
+    long transferAddress;
+    long transferLength;
+    long transferDone;
+    long transferChunk;
+    int transferRetries;
+    bool transferPaused;
+    QByteArray transferData;
+    quint32 transferHash;
+    QByteArray chunkBuffer;
+    QString dumpFileName;
+    QString journalName;
+    //parameters of the job and of the last paused one, as in the journal header
+    QString transferKey;
+    QString pausedJob;
+    long pausedDone;
+    QTimer *transferTimer;
+    //buffer negotiated with the sketch and adaptive chunk size
+    bool negotiating;
+    QByteArray infoBuffer;
+    long deviceMaxPayload;
+    QTimer *negotiateTimer;
+    QTimer *bootTimer;
+    bool resumeAfterBoot;
+    void waitForBoot(bool resume);
+    void startNegotiation();
+    void negotiationFinished();
+    long chunkSize;
+    double lastThroughput;
+    int growCooldown;
+    QElapsedTimer chunkTimer;
+    long pageSize();
+    long chunkLimit();
+    long currentChunkSize();
+    void adaptChunkSize(bool error);
+    void deviceInfoReceived();
+    void startTransfer(TRANSFER_TYPE type, QString deviceAddress, long address, long length);
+    void sendNextChunk();
+    void chunkCompleted();
+    void retryChunk(QString message);
+    void finishTransfer();
+    bool openDumpFile(bool resume);
+    QString journalHeader();
+    long loadJournal();
+    void resetJournal();
+    void appendJournal(long offset, long length);
+    void deviceHashReceived();
+    void logMessage(QString message);
 };
 
 #endif // READWRITEEEPROM_H
@@ -33,3 +33,5 @@ HEADERS += \
 
 FORMS += \
         serialmonitor.ui
+
+include(../common/common.pri)
@@ -22,27 +22,52 @@
 #include "serialmonitor.h"
 #include "ui_serialmonitor.h"
 #include <QMessageBox>
+#include <QFileDialog>
+#include <QFile>
+#include <QStatusBar>
 #include <QtSerialPort/QSerialPortInfo>
 
+//an upload is cancelled when the port does not take any byte for this long
+#define UPLOAD_STALL_TIMEOUT 5000
+
 SerialMonitor::SerialMonitor(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::SerialMonitor)
 {
     ui->setupUi(this);
-    //setup line termination
-    ui->lineTermination->addItem("None", LINE_TERMINATION::NONE);
-    ui->lineTermination->addItem("LF", LINE_TERMINATION::LF);
-    ui->lineTermination->addItem("CR", LINE_TERMINATION::CR);
-    ui->lineTermination->addItem("CR&LF", LINE_TERMINATION::CR_LF);
-    //setup boud rate
-    ui->boudRate->addItem("2400");
-    ui->boudRate->addItem("4800");
-    ui->boudRate->addItem("9600");
-    ui->boudRate->addItem("19200");
-    ui->boudRate->addItem("38400");
-    ui->boudRate->addItem("57600");
-    ui->boudRate->addItem("115200");
-    serial = nullptr;
+    //setup line termination and boud rate
+    SerialWidgets::addLineTerminations(ui->lineTermination);
+    SerialWidgets::addBaudRates(ui->boudRate);
+    //setup flow control
+    ui->flowControl->addItem("No flow", QSerialPort::NoFlowControl);
+    ui->flowControl->addItem("RTS/CTS", QSerialPort::HardwareControl);
+    ui->flowControl->addItem("XON/XOFF", QSerialPort::SoftwareControl);
+    //setup upload, the arduino serial receive buffer is 64 bytes
+    ui->chunkSize->setText("64");
+    ui->chunkDelay->setText("0");
+    ui->uploadProgress->setValue(0);
+    uploadPosition = 0;
+    uploadPending = 0;
+    uploadTimer = new QTimer(this);
+    uploadTimer->setSingleShot(true);
+    connect(uploadTimer, SIGNAL(timeout()), this, SLOT(sendNextChunk()));
+    stallTimer = new QTimer(this);
+    stallTimer->setSingleShot(true);
+    stallTimer->setInterval(UPLOAD_STALL_TIMEOUT);
+    connect(stallTimer, SIGNAL(timeout()), this, SLOT(uploadStalled()));
+    //batch the received text, one view update per 20 ms is enough for reading
+    session = new SerialSession(this);
+    session->setReceiveInterval(20);
+    connect(session, SIGNAL(dataReceived(QByteArray)), this, SLOT(readData(QByteArray)));
+    connect(session, SIGNAL(bytesWritten(qint64)), this, SLOT(uploadBytesWritten(qint64)));
+    connect(session, SIGNAL(connectionLost(QString)), this, SLOT(handleError(QString)));
+    session->setRecorder(&recorder);
+    //the session reopens the board when it is plugged again
+    connect(session, SIGNAL(reconnected(QString)), this, SLOT(boardReconnected(QString)));
+    connect(ui->autoReconnect, SIGNAL(toggled(bool)), session, SLOT(setAutoReconnect(bool)));
+    ui->autoReconnect->setChecked(true);
+    session->setAutoReconnect(ui->autoReconnect->isChecked());
+    SerialWidgets::bindPortList(session->portWatcher(), ui->comPorts);
     connect(ui->connectButton, SIGNAL(clicked(bool)), this, SLOT(connectSerial()));
     connect(ui->disconnectButton, SIGNAL(clicked(bool)), this, SLOT(disconnectSerial()));
     connect(ui->sendButton, SIGNAL(clicked(bool)), this, SLOT(sendData()));
@@ -50,40 +75,31 @@ SerialMonitor::SerialMonitor(QWidget *parent) :
     connect(ui->clearButton, SIGNAL(clicked(bool)), this, SLOT(clearReceive()));
     connect(ui->comListButton, SIGNAL(clicked(bool)), this, SLOT(identifyPorts()));
     connect(ui->boudRate, SIGNAL(currentIndexChanged(int)), this, SLOT(changedBoudRate(int)));
+    connect(ui->lineTermination, SIGNAL(currentIndexChanged(int)), this, SLOT(changedLineTermination(int)));
     connect(ui->serialSendMessage, SIGNAL(returnPressed()), this, SLOT(sendData()));
+    connect(ui->flowControl, SIGNAL(currentIndexChanged(int)), this, SLOT(changedFlowControl(int)));
+    connect(ui->sendFileButton, SIGNAL(clicked(bool)), this, SLOT(sendFile()));
+    connect(ui->stopUploadButton, SIGNAL(clicked(bool)), this, SLOT(cancelUpload()));
+    connect(ui->recordButton, SIGNAL(toggled(bool)), this, SLOT(toggledRecord(bool)));
+    connect(ui->portFilter, SIGNAL(textChanged(QString)), session, SLOT(setPortFilter(QString)));
 }
 
 SerialMonitor::~SerialMonitor()
 {
+    session->setRecorder(nullptr);
+    recorder.stop();
     delete ui;
 }
 
 void SerialMonitor::connectSerial()
 {
-    if (serial != nullptr && serial->isOpen() )
-    {
-        serial->close();
-        delete serial;
-    } else if ( serial != nullptr )
-    {
-        delete serial;
-    }
     QString portName = ui->comPorts->currentText();
     if ( portName.isEmpty() )
         return;
-    serial = new QSerialPort(this);
-    serial->setPortName(portName);
-    serial->setBaudRate(ui->boudRate->currentText().toInt());
-    serial->setDataBits(QSerialPort::Data8);
-    serial->setParity(QSerialPort::NoParity);
-    serial->setStopBits(QSerialPort::OneStop);
-    serial->setFlowControl(QSerialPort::NoFlowControl);
-    connect(serial, SIGNAL(error(QSerialPort::SerialPortError)), this,
-            SLOT(handleError(QSerialPort::SerialPortError)));
-    connect(serial, SIGNAL(readyRead()), this, SLOT(readData()));
-    if (serial->open(QIODevice::ReadWrite))
-    {
-        serial->setDataTerminalReady(true);
+    session->setLineTermination(ui->lineTermination->currentData().toInt());
+    if ( session->open(portName, ui->boudRate->currentText().toInt(),
+                       static_cast<QSerialPort::FlowControl>(ui->flowControl->currentData().toInt())) )
+    {
         ui->statusLine->setText("Connected");
     }
     ui->connectButton->clearFocus();
@@ -91,69 +107,214 @@ void SerialMonitor::connectSerial()
 
 void SerialMonitor::disconnectSerial()
 {
-    if ( serial != nullptr )
+    stopUpload();
+    if ( session->isOpen() )
     {
         ui->statusLine->setText("Disconnected");
-        disconnect(serial, SIGNAL(error(QSerialPort::SerialPortError)), this,
-               SLOT(handleError(QSerialPort::SerialPortError)));
-        disconnect(serial, SIGNAL(readyRead()), this, SLOT(readData()));
-        serial->close();
-        delete serial;
-        serial = nullptr;
+        statusBar()->showMessage(session->metrics());
     }
+    session->close();
     ui->disconnectButton->clearFocus();
 }
 
 void SerialMonitor::sendData()
 {
-    if ( serial == nullptr || !serial->isOpen() )
+    if ( !session->isOpen() )
     {
         QMessageBox::critical(this, tr("First connect to serial."), tr("First connect to serial"), QMessageBox::Ok);
         return;
     }
-    QString str;
-    switch ( ui->lineTermination->currentData().toInt() )
-    {
-    case LINE_TERMINATION::NONE :
-        serial->write(ui->serialSendMessage->text().toLatin1());
-        break;
-    case LINE_TERMINATION::LF :
-        str = ui->serialSendMessage->text();
-        str.append('\n');
-        serial->write(str.toLatin1());
-        break;
-    case LINE_TERMINATION::CR :
-        str = ui->serialSendMessage->text();
-        str.append('\r');
-        serial->write(str.toLatin1());
-        break;
-    case LINE_TERMINATION::CR_LF :
-        str = ui->serialSendMessage->text();
-        str.append("\r\n");
-        serial->write(str.toLatin1());
-        break;
-    default:
-        serial->write(ui->serialSendMessage->text().toLatin1());
-    }
-    serial->flush();
+    if ( !uploadData.isEmpty() )
+    {
+        QMessageBox::critical(this, tr("Upload in progress."), tr("Wait for the current upload to finish"), QMessageBox::Ok);
+        return;
+    }
+    if ( ui->hexMode->isChecked() )
+    {
+        QByteArray data;
+        if ( !hexToBytes(ui->serialSendMessage->text().toLatin1(), data) )
+        {
+            QMessageBox::critical(this, tr("Invalid hex data."), tr("Use pairs of hex digits separated only by whitespace"), QMessageBox::Ok);
+            return;
+        }
+        startUpload(session->frame(data));
+    }
+    else
+        startUpload(session->frame(ui->serialSendMessage->text().toLatin1()));
     ui->sendButton->clearFocus();
 }
 
-void SerialMonitor::handleError(QSerialPort::SerialPortError error)
+void SerialMonitor::sendFile()
 {
-    if (error == QSerialPort::ResourceError) {
-        QMessageBox::critical(this, tr("Critical Error"), serial->errorString());
+    if ( !session->isOpen() )
+    {
+        QMessageBox::critical(this, tr("First connect to serial."), tr("First connect to serial"), QMessageBox::Ok);
+        return;
+    }
+    if ( !uploadData.isEmpty() )
+    {
+        QMessageBox::critical(this, tr("Upload in progress."), tr("Wait for the current upload to finish"), QMessageBox::Ok);
+        return;
+    }
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open file to send to serial"), ".", tr("All files (*)"));
+    ui->sendFileButton->clearFocus();
+    if ( fileName.isEmpty() )
+        return;
+    QFile file(fileName);
+    if ( !file.open(QIODevice::ReadOnly) )
+    {
+        QMessageBox::critical(this, tr("Could not open file."), file.errorString(), QMessageBox::Ok);
+        return;
+    }
+    QByteArray data = file.readAll();
+    file.close();
+    //in hex mode the file is a hex dump separated by whitespace
+    if ( ui->hexMode->isChecked() && !hexToBytes(data, data) )
+    {
+        QMessageBox::critical(this, tr("Invalid hex data."), tr("Use pairs of hex digits separated only by whitespace"), QMessageBox::Ok);
+        return;
+    }
+    startUpload(data);
+}
+
+/*
+ * QByteArray::fromHex skips anything which is not a hex digit,
+ * check the text first so a typo is not sent as a partial payload.
+ */
+bool SerialMonitor::hexToBytes(const QByteArray &text, QByteArray &data)
+{
+    QByteArray digits;
+    for ( int i = 0; i < text.size(); i++ )
+    {
+        char c = text[i];
+        if ( ( c >= '0' && c <= '9' ) || ( c >= 'a' && c <= 'f' ) || ( c >= 'A' && c <= 'F' ) )
+            digits.append(c);
+        else if ( !QChar(c).isSpace() )
+            return false;
+    }
+    if ( digits.size() % 2 != 0 )
+        return false;
+    data = QByteArray::fromHex(digits);
+    return true;
+}
+
+void SerialMonitor::startUpload(const QByteArray &data)
+{
+    if ( data.isEmpty() )
+        return;
+    uploadData = data;
+    uploadPosition = 0;
+    uploadPending = 0;
+    ui->uploadProgress->setRange(0, uploadData.size());
+    ui->uploadProgress->setValue(0);
+    sendNextChunk();
+}
+
+void SerialMonitor::stopUpload()
+{
+    uploadTimer->stop();
+    stallTimer->stop();
+    uploadData.clear();
+    uploadPosition = 0;
+    uploadPending = 0;
+}
+
+//drop the bytes still queued for the port so a stalled board gets nothing more
+void SerialMonitor::cancelUpload()
+{
+    ui->stopUploadButton->clearFocus();
+    if ( uploadData.isEmpty() )
+        return;
+    session->clearOutput();
+    stopUpload();
+    ui->uploadProgress->reset();
+    statusBar()->showMessage(tr("Upload stopped"));
+}
+
+void SerialMonitor::uploadStalled()
+{
+    ui->receiveTexts->moveCursor(QTextCursor::End);
+    ui->receiveTexts->insertPlainText(tr("\nUpload stalled, the board did not take any byte for %1 ms\n").arg(UPLOAD_STALL_TIMEOUT));
+    cancelUpload();
+}
+
+/*
+ * Write the next chunk of the upload, the following one is sent
+ * from uploadBytesWritten when the port has taken all the bytes
+ * so the window is never blocked waiting for the serial.
+ */
+void SerialMonitor::sendNextChunk()
+{
+    if ( uploadData.isEmpty() )
+        return;
+    if ( !session->isOpen() )
+    {
+        stopUpload();
+        return;
+    }
+    qint64 chunk = ui->chunkSize->text().toLongLong();
+    qint64 remaining = uploadData.size() - uploadPosition;
+    if ( chunk <= 0 || chunk > remaining )
+        chunk = remaining;
+    qint64 written = session->write(uploadData.constData() + uploadPosition, chunk);
+    if ( written < 0 )
+    {
+        QMessageBox::critical(this, tr("Upload failed."), session->errorString(), QMessageBox::Ok);
+        stopUpload();
+        ui->uploadProgress->reset();
+        return;
+    }
+    uploadPending = written;
+    uploadPosition += written;
+    stallTimer->start();
+}
+
+void SerialMonitor::uploadBytesWritten(qint64 bytes)
+{
+    if ( uploadData.isEmpty() )
+        return;
+    uploadPending -= bytes;
+    stallTimer->start();
+    if ( uploadPending > 0 )
+    {
+        ui->uploadProgress->setValue(uploadPosition - uploadPending);
+        return;
+    }
+    //the chunk is out, the delay before the next one is not a stall
+    stallTimer->stop();
+    ui->uploadProgress->setValue(uploadPosition);
+    if ( uploadPosition >= uploadData.size() )
+    {
+        stopUpload();
+        statusBar()->showMessage(session->metrics());
+        return;
+    }
+    int delay = ui->chunkDelay->text().toInt();
+    if ( delay > 0 )
+        uploadTimer->start(delay);
+    else
+        sendNextChunk();
+}
+
+void SerialMonitor::handleError(QString error)
+{
+    if ( session->isReconnecting() )
+    {
+        //the board was unplugged or reset, the session waits for it to come back
+        stopUpload();
+        ui->receiveTexts->moveCursor(QTextCursor::End);
+        ui->receiveTexts->insertPlainText(tr("\nConnection lost: ") + error + "\n");
+        ui->statusLine->setText("Waiting for board");
+    } else {
+        QMessageBox::critical(this, tr("Critical Error"), error);
         disconnectSerial();
     }
 }
 
-void SerialMonitor::readData()
+void SerialMonitor::readData(QByteArray data)
 {
-    QString readData = QString::fromStdString(serial->readAll().toStdString());
     ui->receiveTexts->moveCursor(QTextCursor::End);
-    ui->receiveTexts->insertPlainText(readData);
-    serial->flush();
-    QMainWindow::repaint();
+    ui->receiveTexts->insertPlainText(QString::fromStdString(data.toStdString()));
 }
 
 void SerialMonitor::clearReceive()
@@ -165,28 +326,64 @@ void SerialMonitor::clearReceive()
 
 void SerialMonitor::identifyPorts()
 {
-    ui->comPorts->clear();
-    foreach (const QSerialPortInfo &info, QSerialPortInfo::availablePorts())
+    //the list is kept up to date by the port watcher, print only a summary
+    foreach (const QSerialPortInfo &info, session->portWatcher()->ports())
     {
-        QString infoData = QObject::tr("Port: ") + info.portName() + "\n"
-                    + QObject::tr("Location: ") + info.systemLocation() + "\n"
-                    + QObject::tr("Description: ") + info.description() + "\n"
-                    + QObject::tr("Manufacturer: ") + info.manufacturer() + "\n"
-                    + QObject::tr("Serial number: ") + info.serialNumber() + "\n"
-                    + QObject::tr("Busy: ") + (info.isBusy() ? QObject::tr("Yes") : QObject::tr("No")) + "\n"
-                    + "-------------------------------------------\n";
         ui->receiveTexts->moveCursor(QTextCursor::End);
-        ui->receiveTexts->insertPlainText(infoData);
-        ui->comPorts->addItem(info.portName());
+        ui->receiveTexts->insertPlainText(PortWatcher::describe(info) + "\n");
     }
+    session->portWatcher()->rescan();
     ui->comListButton->clearFocus();
-    QMainWindow::repaint();
+}
+
+void SerialMonitor::boardReconnected(QString portName)
+{
+    int index = ui->comPorts->findText(portName);
+    if ( index >= 0 )
+        ui->comPorts->setCurrentIndex(index);
+    else
+        ui->comPorts->setEditText(portName);
+    ui->receiveTexts->moveCursor(QTextCursor::End);
+    ui->receiveTexts->insertPlainText(tr("Board reconnected on ") + portName + "\n");
+    ui->statusLine->setText("Connected");
 }
 
 void SerialMonitor::changedBoudRate(int index)
 {
-    if ( serial != nullptr && serial->isOpen() )
+    session->setBaudRate(ui->boudRate->itemText(index).toInt());
+}
+
+void SerialMonitor::changedFlowControl(int index)
+{
+    session->setFlowControl(static_cast<QSerialPort::FlowControl>(ui->flowControl->itemData(index).toInt()));
+}
+
+void SerialMonitor::changedLineTermination(int index)
+{
+    session->setLineTermination(ui->lineTermination->itemData(index).toInt());
+}
+
+/*
+ * Record the bytes in both directions with their timing,
+ * serial_replay plays the recording back through a pseudo terminal.
+ */
+void SerialMonitor::toggledRecord(bool checked)
+{
+    ui->recordButton->clearFocus();
+    if ( !checked )
+    {
+        recorder.stop();
+        return;
+    }
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Record the session to file"), ".", tr("Session recordings (*.srec)"));
+    if ( fileName.isEmpty() )
+    {
+        ui->recordButton->setChecked(false);
+        return;
+    }
+    if ( !recorder.start(fileName) )
     {
-        serial->setBaudRate(ui->boudRate->currentText().toInt());
+        QMessageBox::critical(this, tr("Could not record the session."), recorder.errorString(), QMessageBox::Ok);
+        ui->recordButton->setChecked(false);
     }
 }
@@ -25,6 +25,9 @@
 
 #include <QMainWindow>
 #include <QSerialPort>
+#include <QTimer>
+#include "serialsession.h"
+#include "serialwidgets.h"
 
 namespace Ui {
 class SerialMonitor;
@@ -42,15 +45,34 @@ private slots:
     void connectSerial();
     void disconnectSerial();
     void sendData();
-    void handleError(QSerialPort::SerialPortError error);
-    void readData();
+    void handleError(QString error);
+    void readData(QByteArray data);
     void clearReceive();
     void identifyPorts();
     void changedBoudRate(int index);
+    void changedFlowControl(int index);
+    void changedLineTermination(int index);
+    void toggledRecord(bool checked);
+    void sendFile();
+    void sendNextChunk();
+    void uploadBytesWritten(qint64 bytes);
+    void cancelUpload();
+    void uploadStalled();
+    void boardReconnected(QString portName);
 private:
     Ui::SerialMonitor *ui;
-    enum LINE_TERMINATION { NONE, LF, CR, CR_LF};
-    QSerialPort *serial;
+    SerialSession *session;
+    SessionRecorder recorder;
+    //data which is streamed to serial in chunks
+    QByteArray uploadData;
+    qint64 uploadPosition;
+    qint64 uploadPending;
+    QTimer *uploadTimer;
+    //a board holding CTS or sending XOFF stops the upload for good
+    QTimer *stallTimer;
+    bool hexToBytes(const QByteArray &text, QByteArray &data);
+    void startUpload(const QByteArray &data);
+    void stopUpload();
 };
 
 #endif // SERIALMONITOR_H
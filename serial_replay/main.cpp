@@ -0,0 +1,282 @@
+/*
+ * Replay of recorded serial sessions for arduino tools
+ *
+ * Copyright 2024 Gabriel Dimitriu
+ *
+ * This file is part of arduino_qt_tools project.
+
+ * arduino_qt_tools is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * arduino_qt_tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with arduino_qt_tools; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+*/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+#include "sessionrecording.h"
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+//host bytes of a sent record are waited at most this long in sync mode
+#define SYNC_TIMEOUT 10000
+//a write is given up when the host does not read for this long
+#define WRITE_TIMEOUT 5000
+
+static qint64 hostBytes = 0;
+
+/*
+ * Read and drop what the host writes until the deadline,
+ * a negative timeout only takes what is already there.
+ */
+static void drainHost(int master, int timeout)
+{
+    char buffer[1024];
+    struct pollfd pfd;
+    pfd.fd = master;
+    pfd.events = POLLIN;
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        int left = timeout < 0 ? 0 : qMax<qint64>(timeout - timer.elapsed(), 0);
+        if ( poll(&pfd, 1, left) <= 0 )
+            return;
+        ssize_t count = ( pfd.revents & POLLIN ) ? read(master, buffer, sizeof(buffer)) : -1;
+        if ( count > 0 )
+        {
+            hostBytes += count;
+            continue;
+        }
+        //the host closed the port, sleep instead of spinning on the hang up
+        if ( timeout < 0 || !( pfd.revents & POLLHUP ) )
+            return;
+        usleep(qMin(left, 100) * 1000);
+    } while ( timeout < 0 || timer.elapsed() < timeout );
+}
+
+//the master reports a hang up while no host has the slave open
+static bool hostConnected(int master)
+{
+    struct pollfd pfd;
+    pfd.fd = master;
+    pfd.events = 0;
+    return poll(&pfd, 1, 0) >= 0 && !( pfd.revents & POLLHUP );
+}
+
+static void waitForHost(int master)
+{
+    while ( !hostConnected(master) )
+        usleep(100000);
+}
+
+/*
+ * The pseudo terminal buffers only a few kilobytes, give up when the
+ * host does not read anything for WRITE_TIMEOUT.
+ */
+static bool writeAll(int master, const QByteArray &data, QString &error)
+{
+    qint64 written = 0;
+    QElapsedTimer stalled;
+    stalled.start();
+    while ( written < data.size() )
+    {
+        ssize_t count = write(master, data.constData() + written, data.size() - written);
+        if ( count < 0 )
+        {
+            if ( errno != EAGAIN && errno != EINTR )
+            {
+                error = QString::fromLocal8Bit(strerror(errno));
+                return false;
+            }
+            if ( stalled.elapsed() > WRITE_TIMEOUT )
+            {
+                error = QString("the host did not read for %1 ms").arg(WRITE_TIMEOUT);
+                return false;
+            }
+            struct pollfd pfd;
+            pfd.fd = master;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, 100);
+            continue;
+        }
+        written += count;
+        stalled.restart();
+    }
+    return true;
+}
+
+/*
+ * The slave is opened once to make it raw and closed again, so that the
+ * master reports a hang up until the host opens the port.
+ */
+static int openPseudoTerminal(QString &slaveName)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ( master < 0 || grantpt(master) != 0 || unlockpt(master) != 0 )
+        return -1;
+    slaveName = QString::fromLocal8Bit(ptsname(master));
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if ( slave < 0 )
+        return -1;
+    struct termios settings;
+    tcgetattr(slave, &settings);
+    cfmakeraw(&settings);
+    tcsetattr(slave, TCSANOW, &settings);
+    close(slave);
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    return master;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("serial_replay");
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays a serial_monitor recording through a pseudo terminal.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("recording", "Session recording (*.srec).");
+    QCommandLineOption speedOption(QStringList() << "s" << "speed",
+            "Speed factor, 1 keeps the recorded timing, 0 replays as fast as possible.", "factor", "1");
+    QCommandLineOption syncOption(QStringList() << "y" << "sync",
+            "Wait for the host to send the recorded bytes before replaying the answers.");
+    QCommandLineOption linkOption(QStringList() << "l" << "link",
+            "Symbolic link to create to the pseudo terminal.", "path");
+    QCommandLineOption waitOption(QStringList() << "w" << "wait",
+            "Also wait for Enter after the host opened the port.");
+    parser.addOption(speedOption);
+    parser.addOption(syncOption);
+    parser.addOption(linkOption);
+    parser.addOption(waitOption);
+    parser.process(a);
+
+    if ( parser.positionalArguments().size() != 1 )
+        parser.showHelp(1);
+    double speed = parser.value(speedOption).toDouble();
+    if ( speed < 0 )
+    {
+        err<<"speed factor must be positive or 0\n";
+        return 1;
+    }
+    SessionReader reader;
+    if ( !reader.open(parser.positionalArguments().at(0)) )
+    {
+        err<<reader.errorString()<<"\n";
+        return 1;
+    }
+#ifdef Q_OS_UNIX
+    QString slaveName;
+    int master = openPseudoTerminal(slaveName);
+    if ( master < 0 )
+    {
+        err<<"could not open a pseudo terminal\n";
+        return 1;
+    }
+    QString linkName = parser.value(linkOption);
+    if ( !linkName.isEmpty() )
+    {
+        QFile::remove(linkName);
+        if ( !QFile::link(slaveName, linkName) )
+        {
+            err<<"could not create the link "<<linkName<<"\n";
+            err.flush();
+        }
+    }
+    out<<"Waiting for the host to open "<<( linkName.isEmpty() ? slaveName : linkName )<<"\n";
+    out.flush();
+    waitForHost(master);
+    out<<"Replaying on "<<slaveName<<"\n";
+    out.flush();
+    if ( parser.isSet(waitOption) )
+    {
+        out<<"Press Enter to start\n";
+        out.flush();
+        QTextStream(stdin).readLine();
+    }
+
+    SessionRecord record;
+    qint64 boardBytes = 0;
+    qint64 expectedHostBytes = 0;
+    qint64 records = 0;
+    //records are timed from the start or, in sync mode, from the last host request
+    qint64 syncTime = 0;
+    QElapsedTimer total;
+    QElapsedTimer clock;
+    total.start();
+    clock.start();
+    while ( reader.next(record) )
+    {
+        records++;
+        if ( record.direction == SessionRecorder::SENT )
+        {
+            expectedHostBytes += record.data.size();
+            if ( parser.isSet(syncOption) )
+            {
+                QElapsedTimer waited;
+                waited.start();
+                while ( hostBytes < expectedHostBytes && waited.elapsed() < SYNC_TIMEOUT )
+                    drainHost(master, 100);
+                if ( hostBytes < expectedHostBytes )
+                {
+                    err<<"host did not send the recorded bytes, continuing\n";
+                    err.flush();
+                }
+                syncTime = record.time;
+                clock.restart();
+            }
+            continue;
+        }
+        if ( speed > 0 )
+        {
+            qint64 due = static_cast<qint64>((record.time - syncTime) / 1000 / speed);
+            while ( clock.elapsed() < due )
+                drainHost(master, due - clock.elapsed());
+        }
+        drainHost(master, -1);
+        QString error;
+        if ( !writeAll(master, record.data, error) )
+        {
+            err<<"could not write to the pseudo terminal: "<<error<<"\n";
+            err.flush();
+            break;
+        }
+        boardBytes += record.data.size();
+    }
+    if ( !reader.errorString().isEmpty() )
+        err<<reader.errorString()<<"\n";
+    double seconds = qMax<qint64>(total.elapsed(), 1) / 1000.0;
+    out<<"Replayed "<<records<<" records, "<<boardBytes<<" bytes to the host and "
+       <<hostBytes<<" bytes from the host\n";
+    out<<"Throughput "<<QString::number(boardBytes / seconds, 'f', 0)<<" B/s\n";
+    //give the host time to read the last answers
+    drainHost(master, 500);
+    if ( !linkName.isEmpty() )
+        QFile::remove(linkName);
+    close(master);
+    return 0;
+#else
+    err<<"pseudo terminals are not available on this platform\n";
+    return 1;
+#endif
+}
@@ -0,0 +1,20 @@
+#-------------------------------------------------
+#
+# Replay of serial_monitor recordings through a pseudo terminal
+#
+#-------------------------------------------------
+
+QT       += core serialport
+QT       -= gui
+
+TARGET = serial_replay
+TEMPLATE = app
+CONFIG += console c++14
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += \
+        main.cpp
+
+include(../common/common.pri)